@@ -44,7 +44,9 @@ public:
     : resolver_(io_service),
       socket_(io_service),
       options_(options),
-      content_length_(0)
+      content_length_(0),
+      persistent_(false),
+      remaining_(0)
   {
   }
 
@@ -54,64 +56,53 @@ public:
     : resolver_(io_service),
       socket_(io_service, arg),
       options_(options),
-      content_length_(0)
+      content_length_(0),
+      persistent_(false),
+      remaining_(0)
   {
   }
 
   boost::system::error_code open(const url& u, boost::system::error_code& ec)
   {
-    // Fail if the socket is already open.
+    bool keep_alive = options_.get_option<urdl::http::keep_alive>().value();
+    std::string host = u.to_string(url::host_component | url::port_component);
+
+    // Reuse the connection if the previous response on it has been read to
+    // the end and the server agreed to keep it open. Otherwise fail if the
+    // socket is already open.
     if (socket_.lowest_layer().is_open())
     {
-      ec = boost::asio::error::already_open;
-      return ec;
+      if (!keep_alive || !persistent_ || remaining_ || host != host_)
+      {
+        ec = boost::asio::error::already_open;
+        return ec;
+      }
     }
+    else
+    {
+      // Establish a connection to the HTTP server.
+      connect(socket_.lowest_layer(), resolver_, u, ec);
+      if (ec)
+        return ec;
 
-    // Establish a connection to the HTTP server.
-    connect(socket_.lowest_layer(), resolver_, u, ec);
-    if (ec)
-      return ec;
-
-    // Perform SSL handshake if required.
-    handshake(socket_, u.host(), ec);
-    if (ec)
-      return ec;
+      // Perform SSL handshake if required.
+      handshake(socket_, u.host(), ec);
+      if (ec)
+        return ec;
+    }
 
-    // Get the HTTP options used to build the request.
-    std::string request_method
-      = options_.get_option<urdl::http::request_method>().value();
-    std::string request_content
-      = options_.get_option<urdl::http::request_content>().value();
-    std::string request_content_type
-      = options_.get_option<urdl::http::request_content_type>().value();
-    std::string user_agent
-      = options_.get_option<urdl::http::user_agent>().value();
+    // Discard the state of any previous response on this connection.
+    host_ = host;
+    persistent_ = false;
+    remaining_ = 0;
+    headers_.clear();
+    content_type_.clear();
+    content_length_ = 0;
+    location_.clear();
 
-    // Form the request. We specify the "Connection: close" header so that the
-    // server will close the socket after transmitting the response. This will
-    // allow us to treat all data up until the EOF as the content.
+    // Form the request.
     std::ostream request_stream(&request_buffer_);
-    request_stream << request_method << " ";
-    request_stream << u.to_string(url::path_component | url::query_component);
-    request_stream << " HTTP/1.0\r\n";
-    request_stream << "Host: ";
-    request_stream << u.to_string(url::host_component | url::port_component);
-    request_stream << "\r\n";
-    request_stream << "Accept: */*\r\n";
-    if (request_content.length())
-    {
-      request_stream << "Content-Length: ";
-      request_stream << request_content.length() << "\r\n";
-      if (request_content_type.length())
-      {
-        request_stream << "Content-Type: ";
-        request_stream << request_content_type << "\r\n";
-      }
-    }
-    if (user_agent.length())
-      request_stream << "User-Agent: " << user_agent << "\r\n";
-    request_stream << "Connection: close\r\n\r\n";
-    request_stream << request_content;
+    build_request(request_stream, options_, u, keep_alive);
 
     // Send the request.
     boost::asio::write(socket_, request_buffer_,
@@ -162,8 +153,18 @@ public:
       return ec;
     }
 
-    // Check the response code to see if we got the page correctly.
-    if (status_code != http::errc::ok)
+    // Work out how much content follows if the connection is to be kept open.
+    bool content_expected = status_code != http::errc::no_content
+      && status_code != http::errc::not_modified
+      && options_.get_option<urdl::http::request_method>().value() != "HEAD";
+    persistent_ = keep_alive
+      && is_persistent_connection(headers_, content_expected);
+    remaining_ = persistent_ && content_expected ? content_length_ : 0;
+
+    // Check the response code to see if we got the page correctly. A partial
+    // response is only sent when a range was requested.
+    if (status_code != http::errc::ok
+        && status_code != http::errc::partial_content)
       ec = make_error_code(static_cast<http::errc::errc_t>(status_code));
 
     return ec;
@@ -178,7 +179,8 @@ public:
         boost::asio::streambuf& request_buffer,
         boost::asio::streambuf& reply_buffer, const url& u,
         std::string& headers, std::string& content_type,
-        std::size_t& content_length, std::string& location)
+        std::size_t& content_length, std::string& location,
+        std::string& host, bool& persistent, std::size_t& remaining)
       : handler_(handler),
         resolver_(resolver),
         socket_(socket),
@@ -190,7 +192,11 @@ public:
         status_code_(0),
         content_type_(content_type),
         content_length_(content_length),
-        location_(location)
+        location_(location),
+        host_(host),
+        keep_alive_(false),
+        persistent_(persistent),
+        remaining_(remaining)
     {
     }
 
@@ -199,72 +205,56 @@ public:
     {
       URDL_CORO_BEGIN;
 
-      // Fail if the socket is already open.
+      keep_alive_ = options_.get_option<urdl::http::keep_alive>().value();
+
+      // Reuse the connection if the previous response on it has been read to
+      // the end and the server agreed to keep it open. Otherwise fail if the
+      // socket is already open.
       if (socket_.lowest_layer().is_open())
       {
-        ec = boost::asio::error::already_open;
-        URDL_CORO_YIELD(socket_.get_io_service().post(
-              boost::asio::detail::bind_handler(*this, ec)));
-        handler_(ec);
-        return;
+        if (!keep_alive_ || !persistent_ || remaining_ || host_
+            != url_.to_string(url::host_component | url::port_component))
+        {
+          ec = boost::asio::error::already_open;
+          URDL_CORO_YIELD(socket_.get_io_service().post(
+                boost::asio::detail::bind_handler(*this, ec)));
+          handler_(ec);
+          return;
+        }
       }
-
-      // Establish a connection to the HTTP server.
-      URDL_CORO_YIELD(async_connect(socket_.lowest_layer(),
-            resolver_, url_, *this));
-      if (ec)
+      else
       {
-        handler_(ec);
-        return;
-      }
+        // Establish a connection to the HTTP server.
+        URDL_CORO_YIELD(async_connect(socket_.lowest_layer(),
+              resolver_, url_, *this));
+        if (ec)
+        {
+          handler_(ec);
+          return;
+        }
 
-      // Perform SSL handshake if required.
-      URDL_CORO_YIELD(async_handshake(socket_, url_.host(), *this));
-      if (ec)
-      {
-        handler_(ec);
-        return;
+        // Perform SSL handshake if required.
+        URDL_CORO_YIELD(async_handshake(socket_, url_.host(), *this));
+        if (ec)
+        {
+          handler_(ec);
+          return;
+        }
       }
 
       {
-        // Get the HTTP options used to build the request.
-        std::string request_method
-          = options_.get_option<urdl::http::request_method>().value();
-        std::string request_content
-          = options_.get_option<urdl::http::request_content>().value();
-        std::string request_content_type
-          = options_.get_option<urdl::http::request_content_type>().value();
-        std::string user_agent
-          = options_.get_option<urdl::http::user_agent>().value();
-
-        // Form the request. We specify the "Connection: close" header so that
-        // the server will close the socket after transmitting the response.
-        // This will allow us to treat all data up until the EOF as the
-        // content.
+        // Discard the state of any previous response on this connection.
+        host_ = url_.to_string(url::host_component | url::port_component);
+        persistent_ = false;
+        remaining_ = 0;
+        headers_.clear();
+        content_type_.clear();
+        content_length_ = 0;
+        location_.clear();
+
+        // Form the request.
         std::ostream request_stream(&request_buffer_);
-        request_stream << request_method << " ";
-        request_stream << url_.to_string(
-            url::path_component | url::query_component);
-        request_stream << " HTTP/1.0\r\n";
-        request_stream << "Host: ";
-        request_stream << url_.to_string(
-            url::host_component | url::port_component);
-        request_stream << "\r\n";
-        request_stream << "Accept: */*\r\n";
-        if (request_content.length())
-        {
-          request_stream << "Content-Length: ";
-          request_stream << request_content.length() << "\r\n";
-          if (request_content_type.length())
-          {
-            request_stream << "Content-Type: ";
-            request_stream << request_content_type << "\r\n";
-          }
-        }
-        if (user_agent.length())
-          request_stream << "User-Agent: " << user_agent << "\r\n";
-        request_stream << "Connection: close\r\n\r\n";
-        request_stream << request_content;
+        build_request(request_stream, options_, url_, keep_alive_);
       }
 
       // Send the request.
@@ -329,8 +319,22 @@ public:
         return;
       }
 
-      // Check the response code to see if we got the page correctly.
-      if (status_code_ != http::errc::ok)
+      // Work out how much content follows if the connection is to be kept
+      // open.
+      {
+        bool content_expected = status_code_ != http::errc::no_content
+          && status_code_ != http::errc::not_modified
+          && options_.get_option<urdl::http::request_method>().value()
+            != "HEAD";
+        persistent_ = keep_alive_
+          && is_persistent_connection(headers_, content_expected);
+        remaining_ = persistent_ && content_expected ? content_length_ : 0;
+      }
+
+      // Check the response code to see if we got the page correctly. A
+      // partial response is only sent when a range was requested.
+      if (status_code_ != http::errc::ok
+          && status_code_ != http::errc::partial_content)
         ec = make_error_code(static_cast<http::errc::errc_t>(status_code_));
 
       handler_(ec);
@@ -373,14 +377,18 @@ public:
     std::string& content_type_;
     std::size_t& content_length_;
     std::string& location_;
+    std::string& host_;
+    bool keep_alive_;
+    bool& persistent_;
+    std::size_t& remaining_;
   };
 
   template <typename Handler>
   void async_open(const url& u, Handler handler)
   {
     open_coro<Handler>(handler, resolver_, socket_, options_, request_buffer_,
-        reply_buffer_, u, headers_, content_type_, content_length_, location_)(
-          boost::system::error_code(), 0);
+        reply_buffer_, u, headers_, content_type_, content_length_, location_,
+        host_, persistent_, remaining_)(boost::system::error_code(), 0);
   }
 
   boost::system::error_code close(boost::system::error_code& ec)
@@ -394,6 +402,9 @@ public:
       content_type_.clear();
       content_length_ = 0;
       location_.clear();
+      host_.clear();
+      persistent_ = false;
+      remaining_ = 0;
     }
     return ec;
   }
@@ -403,6 +414,11 @@ public:
     return socket_.lowest_layer().is_open();
   }
 
+  bool is_reusable() const
+  {
+    return socket_.lowest_layer().is_open() && persistent_ && remaining_ == 0;
+  }
+
   std::string content_type() const
   {
     return content_type_;
@@ -427,20 +443,33 @@ public:
   std::size_t read_some(const MutableBufferSequence& buffers,
       boost::system::error_code& ec)
   {
+    // On a persistent connection the content ends after Content-Length bytes.
+    if (persistent_ && remaining_ == 0)
+    {
+      ec = boost::asio::error::eof;
+      return 0;
+    }
+
     // If we have any data in the reply_buffer_, return that first.
     if (reply_buffer_.size() > 0)
     {
       std::size_t bytes_transferred = 0;
       typename MutableBufferSequence::const_iterator iter = buffers.begin();
       typename MutableBufferSequence::const_iterator end = buffers.end();
-      for (; iter != end && reply_buffer_.size() > 0; ++iter)
+      for (; iter != end && reply_buffer_.size() > 0
+          && (!persistent_ || remaining_ > 0); ++iter)
       {
         boost::asio::mutable_buffer buffer(*iter);
         size_t length = boost::asio::buffer_size(buffer);
+        if (persistent_ && length > remaining_)
+          length = remaining_;
         if (length > 0)
         {
-          bytes_transferred += reply_buffer_.sgetn(
+          std::size_t n = reply_buffer_.sgetn(
               boost::asio::buffer_cast<char*>(buffer), length);
+          bytes_transferred += n;
+          if (persistent_)
+            remaining_ -= n;
         }
       }
       ec = boost::system::error_code();
@@ -448,7 +477,14 @@ public:
     }
 
     // Otherwise we forward the call to the underlying socket.
-    std::size_t bytes_transferred = socket_.read_some(buffers, ec);
+    std::size_t bytes_transferred = 0;
+    if (persistent_)
+    {
+      bytes_transferred = socket_.read_some(limit_buffers(buffers), ec);
+      remaining_ -= bytes_transferred;
+    }
+    else
+      bytes_transferred = socket_.read_some(buffers, ec);
     if (ec == boost::asio::error::shut_down)
       ec = boost::asio::error::eof;
     return bytes_transferred;
@@ -458,13 +494,16 @@ public:
   class read_handler
   {
   public:
-    read_handler(Handler handler)
-      : handler_(handler)
+    read_handler(Handler handler, std::size_t* remaining)
+      : handler_(handler),
+        remaining_(remaining)
     {
     }
 
     void operator()(boost::system::error_code ec, std::size_t bytes_transferred)
     {
+      if (remaining_)
+        *remaining_ -= bytes_transferred;
       if (ec == boost::asio::error::shut_down)
         ec = boost::asio::error::eof;
       handler_(ec, bytes_transferred);
@@ -494,13 +533,15 @@ public:
 
   private:
     Handler handler_;
+    std::size_t* remaining_;
   };
 
   template <typename MutableBufferSequence, typename Handler>
   void async_read_some(const MutableBufferSequence& buffers, Handler handler)
   {
-    // If we have any data in the reply_buffer_, return that first.
-    if (reply_buffer_.size() > 0)
+    // If the content has been read to the end, or we have any data in the
+    // reply_buffer_, return that first.
+    if ((persistent_ && remaining_ == 0) || reply_buffer_.size() > 0)
     {
       boost::system::error_code ec;
       std::size_t bytes_transferred = read_some(buffers, ec);
@@ -510,7 +551,69 @@ public:
     }
 
     // Otherwise we forward the call to the underlying socket.
-    socket_.async_read_some(buffers, read_handler<Handler>(handler));
+    if (persistent_)
+    {
+      socket_.async_read_some(limit_buffers(buffers),
+          read_handler<Handler>(handler, &remaining_));
+    }
+    else
+      socket_.async_read_some(buffers, read_handler<Handler>(handler, 0));
+  }
+
+private:
+  // Forms the request. Unless the connection is to be kept alive, we specify
+  // the "Connection: close" header so that the server will close the socket
+  // after transmitting the response. This will allow us to treat all data up
+  // until the EOF as the content.
+  static void build_request(std::ostream& request_stream,
+      const option_set& options, const url& u, bool keep_alive)
+  {
+    // Get the HTTP options used to build the request.
+    std::string request_method
+      = options.get_option<urdl::http::request_method>().value();
+    std::string request_content
+      = options.get_option<urdl::http::request_content>().value();
+    std::string request_content_type
+      = options.get_option<urdl::http::request_content_type>().value();
+    std::string user_agent
+      = options.get_option<urdl::http::user_agent>().value();
+    std::string request_headers
+      = options.get_option<urdl::http::request_headers>().value();
+
+    request_stream << request_method << " ";
+    request_stream << u.to_string(url::path_component | url::query_component);
+    request_stream << " HTTP/1.0\r\n";
+    request_stream << "Host: ";
+    request_stream << u.to_string(url::host_component | url::port_component);
+    request_stream << "\r\n";
+    request_stream << "Accept: */*\r\n";
+    if (request_content.length())
+    {
+      request_stream << "Content-Length: ";
+      request_stream << request_content.length() << "\r\n";
+      if (request_content_type.length())
+      {
+        request_stream << "Content-Type: ";
+        request_stream << request_content_type << "\r\n";
+      }
+    }
+    if (user_agent.length())
+      request_stream << "User-Agent: " << user_agent << "\r\n";
+    request_stream << request_headers;
+    if (keep_alive)
+      request_stream << "Connection: keep-alive\r\n\r\n";
+    else
+      request_stream << "Connection: close\r\n\r\n";
+    request_stream << request_content;
+  }
+
+  // Limits a read to the content remaining on a persistent connection.
+  template <typename MutableBufferSequence>
+  boost::asio::mutable_buffers_1 limit_buffers(
+      const MutableBufferSequence& buffers)
+  {
+    return boost::asio::buffer(
+        boost::asio::mutable_buffer(*buffers.begin()), remaining_);
   }
 
 private:
@@ -523,6 +626,9 @@ private:
   std::string content_type_;
   std::size_t content_length_;
   std::string location_;
+  std::string host_;
+  bool persistent_;
+  std::size_t remaining_;
 };
 
 } // namespace detail
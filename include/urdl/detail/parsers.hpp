@@ -74,6 +74,38 @@ inline void check_header(const std::string& name, const std::string& value,
     location = value;
 }
 
+// Determines whether the server agreed to keep the connection open once the
+// content has been read. A keep-alive response must say so explicitly and must
+// delimit its content with Content-Length, unless no content is expected.
+inline bool is_persistent_connection(const std::string& headers,
+    bool content_expected)
+{
+  bool keep_alive = false;
+  bool content_length = false;
+  std::string::size_type pos = 0;
+  while (pos < headers.length())
+  {
+    std::string::size_type end = headers.find("\r\n", pos);
+    if (end == std::string::npos)
+      end = headers.length();
+    std::string::size_type colon = headers.find(':', pos);
+    if (colon != std::string::npos && colon < end)
+    {
+      std::string name(headers, pos, colon - pos);
+      std::string value(headers, colon + 1, end - colon - 1);
+      std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+      if (headers_equal(name, "Connection"))
+        keep_alive = value.find("keep-alive") != std::string::npos;
+      else if (headers_equal(name, "Content-Length"))
+        content_length = true;
+      else if (headers_equal(name, "Transfer-Encoding"))
+        return false;
+    }
+    pos = end + 2;
+  }
+  return keep_alive && (content_length || !content_expected);
+}
+
 template <typename Iterator>
 bool parse_http_status_line(Iterator begin, Iterator end,
     int& version_major, int& version_minor, int& status)
@@ -412,6 +412,158 @@ private:
   std::string value_;
 };
 
+/// Option to specify additional HTTP request headers.
+/**
+ * @par Remarks
+ * The default is to not send any additional headers. Each header line must be
+ * terminated by "\r\n".
+ *
+ * @par Example
+ * To request part of a resource using an object of class @c urdl::istream:
+ * @code
+ * urdl::istream is;
+ * is.set_option(urdl::http::request_headers("Range: bytes=1024-\r\n"));
+ * is.open("http://www.boost.org");
+ * @endcode
+ *
+ * To request part of a resource using an object of class
+ * @c urdl::read_stream:
+ * @code
+ * urdl::read_stream stream;
+ * stream.set_option(urdl::http::request_headers("Range: bytes=1024-\r\n"));
+ * stream.open("http://www.boost.org");
+ * @endcode
+ *
+ * @par Requirements
+ * @e Header: @c <urdl/http.hpp> @n
+ * @e Namespace: @c urdl::http
+ */
+class request_headers
+{
+public:
+  /// Constructs an object of class @c request_headers.
+  /**
+   * @par Remarks
+   * Postcondition: <tt>value() == ""</tt>.
+   */
+  request_headers()
+    : value_("")
+  {
+  }
+
+  /// Constructs an object of class @c request_headers.
+  /**
+   * @param v The desired value for the option.
+   *
+   * @par Remarks
+   * Postcondition: <tt>value() == v</tt>
+   */
+  explicit request_headers(const std::string& v)
+    : value_(v)
+  {
+  }
+
+  /// Gets the value of the option.
+  /**
+   * @returns The value of the option.
+   */
+  std::string value() const
+  {
+    return value_;
+  }
+
+  /// Sets the value of the option.
+  /**
+   * @param v The desired value for the option.
+   *
+   * @par Remarks
+   * Postcondition: <tt>value() == v</tt>
+   */
+  void value(const std::string& v)
+  {
+    value_ = v;
+  }
+
+private:
+  std::string value_;
+};
+
+/// Option to specify whether HTTP connections should be kept alive.
+/**
+ * @par Remarks
+ * The default is to close the connection once the content has been read. When
+ * enabled, the request asks the server to keep the connection open, and the
+ * content is delimited by the Content-Length header instead of by the end of
+ * the stream. If the server agrees, the stream may be opened again for another
+ * URL on the same host without establishing a new connection. Use
+ * @c read_stream::is_reusable to determine whether this is possible.
+ *
+ * @par Example
+ * To fetch two resources over one connection using an object of class
+ * @c urdl::read_stream:
+ * @code
+ * urdl::read_stream stream;
+ * stream.set_option(urdl::http::keep_alive(true));
+ * stream.open("http://www.boost.org/LICENSE_1_0.txt");
+ * // ... read until EOF ...
+ * if (stream.is_reusable())
+ *   stream.open("http://www.boost.org/index.html");
+ * @endcode
+ *
+ * @par Requirements
+ * @e Header: @c <urdl/http.hpp> @n
+ * @e Namespace: @c urdl::http
+ */
+class keep_alive
+{
+public:
+  /// Constructs an object of class @c keep_alive.
+  /**
+   * @par Remarks
+   * Postcondition: <tt>value() == false</tt>.
+   */
+  keep_alive()
+    : value_(false)
+  {
+  }
+
+  /// Constructs an object of class @c keep_alive.
+  /**
+   * @param v The desired value for the option.
+   *
+   * @par Remarks
+   * Postcondition: <tt>value() == v</tt>
+   */
+  explicit keep_alive(bool v)
+    : value_(v)
+  {
+  }
+
+  /// Gets the value of the option.
+  /**
+   * @returns The value of the option.
+   */
+  bool value() const
+  {
+    return value_;
+  }
+
+  /// Sets the value of the option.
+  /**
+   * @param v The desired value for the option.
+   *
+   * @par Remarks
+   * Postcondition: <tt>value() == v</tt>
+   */
+  void value(bool v)
+  {
+    value_ = v;
+  }
+
+private:
+  bool value_;
+};
+
 namespace errc {
 
 /// HTTP error codes.
@@ -234,6 +234,28 @@ public:
     }
   }
 
+  /// Determines whether the stream can be opened again without reconnecting.
+  /**
+   * @returns @c true if the @c urdl::http::keep_alive option was set, the
+   * server agreed to keep the connection open, and the content has been read
+   * to the end. The stream may then be opened for another URL on the same host
+   * without closing it first.
+   */
+  bool is_reusable() const
+  {
+    switch (protocol_)
+    {
+    case http:
+      return http_.is_reusable();
+#if !defined(URDL_DISABLE_SSL)
+    case https:
+      return https_.is_reusable();
+#endif // !defined(URDL_DISABLE_SSL)
+    default:
+      return false;
+    }
+  }
+
   /// Opens the specified URL.
   /**
    * @param u The URL to open.
@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2012 Incognito
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "archive.h"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/format.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace
+{
+	const char ArchiveMagic[4] = { 'S', 'A', 'P', 'K' };
+	const boost::uint32_t ArchiveVersion = 1;
+
+	struct UnmapView
+	{
+		void operator()(const char *view) const
+		{
+			UnmapViewOfFile(view);
+		}
+	};
+}
+
+Archive::Archive()
+{
+	file = INVALID_HANDLE_VALUE;
+	fileSize = 0;
+	mapping = NULL;
+}
+
+Archive::~Archive()
+{
+	if (mapping)
+	{
+		CloseHandle(mapping);
+	}
+	if (file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(file);
+	}
+}
+
+Archive::Entry::Entry()
+{
+	length = 0;
+	offset = 0;
+	verified = false;
+}
+
+const Archive::Entry *Archive::findEntry(const std::string &name) const
+{
+	std::map<std::string, Entry>::const_iterator e = entries.find(boost::algorithm::to_lower_copy(name));
+	if (e != entries.end())
+	{
+		return &e->second;
+	}
+	return NULL;
+}
+
+boost::shared_ptr<const char> Archive::mapEntry(const Entry &entry) const
+{
+	if (!entry.length)
+	{
+		return boost::shared_ptr<const char>();
+	}
+	static DWORD allocationGranularity = 0;
+	if (!allocationGranularity)
+	{
+		SYSTEM_INFO systemInfo;
+		GetSystemInfo(&systemInfo);
+		allocationGranularity = systemInfo.dwAllocationGranularity;
+	}
+	std::size_t viewOffset = entry.offset - entry.offset % allocationGranularity;
+	const char *view = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, static_cast<DWORD>(viewOffset), entry.offset - viewOffset + entry.length));
+	if (!view)
+	{
+		return boost::shared_ptr<const char>();
+	}
+	boost::shared_ptr<const char> data(view, UnmapView());
+	return boost::shared_ptr<const char>(data, view + (entry.offset - viewOffset));
+}
+
+bool Archive::open(const std::wstring &filePath)
+{
+	file = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	DWORD highSize = 0;
+	DWORD lowSize = GetFileSize(file, &highSize);
+	if (lowSize == INVALID_FILE_SIZE || highSize)
+	{
+		return false;
+	}
+	fileSize = lowSize;
+	mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping)
+	{
+		return false;
+	}
+	return readIndex();
+}
+
+void Archive::removeEntry(const std::string &name)
+{
+	entries.erase(boost::algorithm::to_lower_copy(name));
+}
+
+std::size_t Archive::size() const
+{
+	return entries.size();
+}
+
+void Archive::verifyEntry(const std::string &name)
+{
+	std::map<std::string, Entry>::iterator e = entries.find(boost::algorithm::to_lower_copy(name));
+	if (e != entries.end())
+	{
+		e->second.verified = true;
+	}
+}
+
+bool Archive::readData(std::size_t offset, void *buffer, std::size_t length)
+{
+	if (offset > fileSize || length > fileSize - offset)
+	{
+		return false;
+	}
+	OVERLAPPED overlapped = { 0 };
+	overlapped.Offset = static_cast<DWORD>(offset);
+	DWORD readBytes = 0;
+	return ReadFile(file, buffer, static_cast<DWORD>(length), &readBytes, &overlapped) && readBytes == length;
+}
+
+bool Archive::readIndex()
+{
+	char header[sizeof(ArchiveMagic) + sizeof(boost::uint32_t) * 2];
+	if (!readData(0, header, sizeof(header)) || std::memcmp(header, ArchiveMagic, sizeof(ArchiveMagic)))
+	{
+		return false;
+	}
+	boost::uint32_t version = 0, count = 0;
+	std::memcpy(&version, header + 4, sizeof(version));
+	std::memcpy(&count, header + 8, sizeof(count));
+	if (version != ArchiveVersion)
+	{
+		return false;
+	}
+	std::size_t position = sizeof(header);
+	std::vector<char> record;
+	for (boost::uint32_t i = 0; i < count; ++i)
+	{
+		boost::uint16_t nameLength = 0;
+		if (!readData(position, &nameLength, sizeof(nameLength)))
+		{
+			return false;
+		}
+		position += sizeof(nameLength);
+		record.resize(nameLength + sizeof(boost::uint32_t) * 3);
+		if (!readData(position, &record[0], record.size()))
+		{
+			return false;
+		}
+		position += record.size();
+		boost::uint32_t crc = 0, length = 0, offset = 0;
+		std::memcpy(&offset, &record[nameLength], sizeof(offset));
+		std::memcpy(&length, &record[nameLength + 4], sizeof(length));
+		std::memcpy(&crc, &record[nameLength + 8], sizeof(crc));
+		if (offset > fileSize || length > fileSize - offset)
+		{
+			return false;
+		}
+		Entry entry;
+		entry.checksum = boost::str(boost::format("%X") % crc);
+		entry.length = length;
+		entry.offset = offset;
+		entries[boost::algorithm::to_lower_copy(std::string(record.begin(), record.begin() + nameLength))] = entry;
+	}
+	return true;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2012 Incognito
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <boost/shared_ptr.hpp>
+
+#include <cstddef>
+#include <map>
+#include <string>
+
+#include <windows.h>
+
+class Archive
+{
+public:
+	Archive();
+	~Archive();
+
+	struct Entry
+	{
+		Entry();
+
+		std::string checksum;
+		std::size_t length;
+		std::size_t offset;
+		bool verified;
+	};
+
+	const Entry *findEntry(const std::string &name) const;
+	boost::shared_ptr<const char> mapEntry(const Entry &entry) const;
+	bool open(const std::wstring &filePath);
+	void removeEntry(const std::string &name);
+	std::size_t size() const;
+	void verifyEntry(const std::string &name);
+private:
+	Archive(const Archive &);
+	Archive &operator=(const Archive &);
+
+	bool readData(std::size_t offset, void *buffer, std::size_t length);
+	bool readIndex();
+
+	std::map<std::string, Entry> entries;
+	HANDLE file;
+	std::size_t fileSize;
+	HANDLE mapping;
+};
+
+#endif
@@ -16,7 +16,9 @@
 
 #include "audio.h"
 
+#include "archive.h"
 #include "core.h"
+#include "plugin.h"
 
 #include <BASS/bass.h>
 #include <BASS/bassmix.h>
@@ -28,7 +30,9 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
 
+#include <algorithm>
 #include <map>
 #include <string>
 #include <vector>
@@ -130,6 +134,22 @@ Audio::Stream::Stream()
 	mixer = 0;
 }
 
+Audio::PendingPlay::PendingPlay()
+{
+	audioID = 0;
+	downmix = false;
+	loop = false;
+	pause = false;
+	sequence = false;
+}
+
+Audio::ProgressiveFile::ProgressiveFile()
+{
+	handle = INVALID_HANDLE_VALUE;
+	position = 0;
+	thread = GetCurrentThreadId();
+}
+
 Audio::Stream::Position::Position()
 {
 	distance = 0.0f;
@@ -145,14 +165,121 @@ Audio::Stream::Sequence::Sequence()
 	pause = false;
 }
 
+bool Audio::cancelPendingPlay(int handleID)
+{
+	if (!pendingPlays.erase(handleID))
+	{
+		return false;
+	}
+	std::map<int, Stream>::iterator s = streams.find(handleID);
+	if (s != streams.end())
+	{
+		core->getProgram()->logText(boost::str(boost::format("Stopped: \"%1%\"") % s->second.name));
+		eraseStream(s);
+	}
+	core->getNetwork()->sendAsync(boost::str(boost::format("%1%\t%2%\n") % Client::Stop % handleID));
+	return true;
+}
+
+void Audio::cancelRead(Stream &stream)
+{
+	if (!stream.progress)
+	{
+		return;
+	}
+	{
+		boost::lock_guard<boost::mutex> lock(stream.progress->mutex);
+		*stream.cancelled = true;
+	}
+	stream.progress->condition.notify_all();
+}
+
+DWORD Audio::createFileStream(Stream &stream, const std::string &fileName, const std::wstring &filePath)
+{
+	if (filePath.empty())
+	{
+		boost::shared_ptr<Archive> archive = core->getTransfer()->archive;
+		const Archive::Entry *entry = archive ? archive->findEntry(fileName) : NULL;
+		if (!entry)
+		{
+			return 0;
+		}
+		stream.archiveData = archive->mapEntry(*entry);
+		if (!stream.archiveData)
+		{
+			return 0;
+		}
+		if (isModuleFile(fileName))
+		{
+			return BASS_MusicLoad(true, stream.archiveData.get(), 0, static_cast<DWORD>(entry->length), BASS_SAMPLE_FLOAT | BASS_MUSIC_PRESCAN | BASS_MUSIC_DECODE, 0);
+		}
+		return BASS_StreamCreateFile(true, stream.archiveData.get(), 0, entry->length, BASS_SAMPLE_FLOAT | BASS_STREAM_DECODE);
+	}
+	if (isModuleFile(fileName))
+	{
+		return BASS_MusicLoad(false, filePath.c_str(), 0, 0, BASS_SAMPLE_FLOAT | BASS_MUSIC_PRESCAN | BASS_MUSIC_DECODE | BASS_UNICODE, 0);
+	}
+	return BASS_StreamCreateFile(false, filePath.c_str(), 0, 0, BASS_SAMPLE_FLOAT | BASS_STREAM_DECODE | BASS_UNICODE);
+}
+
+DWORD Audio::createProgressiveStream(Stream &stream, const std::wstring &filePath, const boost::shared_ptr<Transfer::Progress> &progress)
+{
+	ProgressiveFile *progressiveFile = new ProgressiveFile;
+	progressiveFile->handle = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (progressiveFile->handle == INVALID_HANDLE_VALUE)
+	{
+		delete progressiveFile;
+		return 0;
+	}
+	progressiveFile->cancelled.reset(new bool(false));
+	progressiveFile->progress = progress;
+	stream.cancelled = progressiveFile->cancelled;
+	stream.progress = progress;
+	BASS_FILEPROCS fileProcs = { &onFileClose, &onFileLength, &onFileRead, &onFileSeek };
+	return BASS_StreamCreateFileUser(STREAMFILE_BUFFER, BASS_SAMPLE_FLOAT | BASS_STREAM_DECODE, &fileProcs, progressiveFile);
+}
+
 void Audio::freeMemory()
 {
 	files.clear();
-	streams.clear();
+	pendingPlays.clear();
+	std::map<int, Stream> freedStreams;
+	freedStreams.swap(streams);
+	for (std::map<int, Stream>::iterator s = freedStreams.begin(); s != freedStreams.end(); ++s)
+	{
+		freeStream(s->second);
+	}
 	stopped = true;
 	BASS_Stop();
 }
 
+void Audio::eraseStream(std::map<int, Stream>::iterator s)
+{
+	Stream stream = s->second;
+	streams.erase(s);
+	freeStream(stream);
+}
+
+void Audio::freeChannel(DWORD &channel)
+{
+	if (channel && !BASS_StreamFree(channel))
+	{
+		BASS_MusicFree(channel);
+	}
+	channel = 0;
+}
+
+void Audio::freeStream(Stream &stream)
+{
+	cancelRead(stream);
+	freeChannel(stream.channel);
+	if (stream.mixer)
+	{
+		BASS_StreamFree(stream.mixer);
+		stream.mixer = 0;
+	}
+}
+
 std::string Audio::getErrorMessage()
 {
 	int errorCode = BASS_ErrorGetCode();
@@ -164,6 +291,11 @@ std::string Audio::getErrorMessage()
 	return "Error code not found";
 }
 
+bool Audio::isArchivedFile(const std::string &fileName)
+{
+	return core->getTransfer()->archive && core->getTransfer()->archive->findEntry(fileName);
+}
+
 bool Audio::isModuleFile(std::string fileName)
 {
 	const char *fileExtensions[] =
@@ -198,6 +330,27 @@ void Audio::initializeSequence(int handleID)
 		return;
 	}
 	s->second.name = boost::str(boost::format("Sequence ID: %1%") % s->second.sequence->id);
+	bool pending = false;
+	for (std::vector<int>::reverse_iterator a = s->second.sequence->audioIDs.rbegin(); a != s->second.sequence->audioIDs.rend(); ++a)
+	{
+		if (files.find(*a) == files.end())
+		{
+			pending = core->getTransfer()->promoteFile(*a);
+		}
+		else
+		{
+			pending = false;
+		}
+	}
+	if (pending)
+	{
+		PendingPlay pendingPlay;
+		pendingPlay.audioID = s->second.sequence->audioIDs.front();
+		pendingPlay.sequence = true;
+		pendingPlays[handleID] = pendingPlay;
+		core->getProgram()->logText(boost::str(boost::format("Waiting for transfer of audio ID %1% to start \"%2%\"") % pendingPlay.audioID % s->second.name));
+		return;
+	}
 	if (!s->second.sequence->downmix)
 	{
 		s->second.mixer = BASS_Mixer_StreamCreate(44100, 2, BASS_SAMPLE_FLOAT | BASS_MIXER_END | BASS_STREAM_AUTOFREE);
@@ -212,14 +365,14 @@ void Audio::initializeSequence(int handleID)
 	{
 		core->getProgram()->logText(boost::str(boost::format("Error creating mixer for playback of \"%1%\": %2%") % s->second.name % core->getAudio()->getErrorMessage()));
 		core->getNetwork()->sendAsync(boost::str(boost::format("%1%\t%2%\t%3%\n") % Client::Play % handleID % Client::Failure));
-		streams.erase(s);
+		eraseStream(s);
 		return;
 	}
 	playNextFileInSequence(s->first);
 	if (!s->second.channel)
 	{
 		core->getNetwork()->sendAsync(boost::str(boost::format("%1%\t%2%\t%3%\n") % Client::Play % handleID % Client::Failure));
-		streams.erase(s);
+		eraseStream(s);
 		return;
 	}
 	BASS_ChannelPlay(s->second.mixer, false);
@@ -261,8 +414,11 @@ void Audio::playNextFileInSequence(int handleID)
 			std::map<int, std::string>::iterator f = files.find(*a);
 			if (f != files.end())
 			{
-				filePath = boost::str(boost::wformat(L"%1%\\%2%") % core->getProgram()->downloadPath % core->strtowstr(f->second));
-				if (!boost::filesystem::exists(filePath))
+				if (!isArchivedFile(f->second))
+				{
+					filePath = boost::str(boost::wformat(L"%1%\\%2%") % core->getProgram()->downloadPath % core->strtowstr(f->second));
+				}
+				if (!filePath.empty() && !boost::filesystem::exists(filePath))
 				{
 					core->getProgram()->logText(boost::str(boost::format("Error creating stream for playback of \"%1%\": File does not exist") % f->second));
 					return;
@@ -273,19 +429,14 @@ void Audio::playNextFileInSequence(int handleID)
 				core->getNetwork()->sendAsync(boost::str(boost::format("%1%\t%2%\t%3%\n") % Client::Play % handleID % Client::Failure));
 				return;
 			}
-			if (isModuleFile(f->second))
-			{
-				s->second.channel = BASS_MusicLoad(false, filePath.c_str(), 0, 0, BASS_SAMPLE_FLOAT | BASS_MUSIC_PRESCAN | BASS_MUSIC_DECODE | BASS_UNICODE, 0);
-			}
-			else
-			{
-				s->second.channel = BASS_StreamCreateFile(false, filePath.c_str(), 0, 0, BASS_SAMPLE_FLOAT | BASS_STREAM_DECODE | BASS_UNICODE);
-			}
+			freeChannel(s->second.channel);
+			s->second.channel = createFileStream(s->second, f->second, filePath);
 			if (!s->second.channel)
 			{
 				core->getProgram()->logText(boost::str(boost::format("Error creating stream for playback of \"%1%\": %2%") % f->second % core->getAudio()->getErrorMessage()));
 				return;
 			}
+			core->getCache()->touchFile(f->second);
 			DWORD channelFlags = BASS_STREAM_AUTOFREE | BASS_MIXER_NORAMPIN;
 			if (s->second.sequence->downmix)
 			{
@@ -308,6 +459,7 @@ void Audio::playStream(int handleID, bool pause, bool loop, bool downmix)
 	}
 	bool remote = false;
 	std::wstring filePath;
+	boost::shared_ptr<Transfer::Progress> progress;
 	if (boost::algorithm::icontains(s->second.name, "://"))
 	{
 		remote = true;
@@ -327,20 +479,53 @@ void Audio::playStream(int handleID, bool pause, bool loop, bool downmix)
 		if (f != files.end())
 		{
 			s->second.name = f->second;
-			filePath = boost::str(boost::wformat(L"%1%\\%2%") % core->getProgram()->downloadPath % core->strtowstr(f->second));
-			if (!boost::filesystem::exists(filePath))
+			if (!isArchivedFile(f->second))
+			{
+				filePath = boost::str(boost::wformat(L"%1%\\%2%") % core->getProgram()->downloadPath % core->strtowstr(f->second));
+			}
+			if (!filePath.empty() && !boost::filesystem::exists(filePath))
 			{
 				core->getProgram()->logText(boost::str(boost::format("Error opening \"%1%\" for playback: File does not exist") % s->second.name));
 				core->getNetwork()->sendAsync(boost::str(boost::format("%1%\t%2%\t%3%\n") % Client::Play % handleID % Client::Failure));
-				streams.erase(s);
+				eraseStream(s);
 				return;
 			}
 		}
 		else
 		{
-			core->getNetwork()->sendAsync(boost::str(boost::format("%1%\t%2%\t%3%\n") % Client::Play % handleID % Client::Failure));
-			streams.erase(s);
-			return;
+			boost::shared_ptr<Transfer::File> file = core->getTransfer()->findFile(audioID);
+			if (file && !isModuleFile(file->name))
+			{
+				std::size_t bufferedBytes = PROGRESSIVE_BUFFER;
+				boost::lock_guard<boost::mutex> lock(file->progress->mutex);
+				if (file->progress->size && file->progress->size < bufferedBytes)
+				{
+					bufferedBytes = file->progress->size;
+				}
+				if (file->progress->availableBytes >= bufferedBytes)
+				{
+					progress = file->progress;
+				}
+			}
+			if (!progress && core->getTransfer()->promoteFile(audioID))
+			{
+				PendingPlay pendingPlay;
+				pendingPlay.audioID = audioID;
+				pendingPlay.downmix = downmix;
+				pendingPlay.loop = loop;
+				pendingPlay.pause = pause;
+				pendingPlays[handleID] = pendingPlay;
+				core->getProgram()->logText(boost::str(boost::format("Waiting for transfer of audio ID %1% to start playback") % audioID));
+				return;
+			}
+			if (!progress)
+			{
+				core->getNetwork()->sendAsync(boost::str(boost::format("%1%\t%2%\t%3%\n") % Client::Play % handleID % Client::Failure));
+				eraseStream(s);
+				return;
+			}
+			s->second.name = file->name;
+			filePath = file->temporaryPath.empty() ? file->path : file->temporaryPath;
 		}
 	}
 	else
@@ -349,7 +534,7 @@ void Audio::playStream(int handleID, bool pause, bool loop, bool downmix)
 		{
 			core->getProgram()->logText(boost::str(boost::format("Playback of \"%1%\" rejected (file streaming disabled)") % s->second.name));
 			core->getNetwork()->sendAsync(boost::str(boost::format("%1%\t%2%\t%3%\n") % Client::Play % handleID % Client::Failure));
-			streams.erase(s);
+			eraseStream(s);
 			return;
 		}
 	}
@@ -367,19 +552,16 @@ void Audio::playStream(int handleID, bool pause, bool loop, bool downmix)
 	{
 		core->getProgram()->logText(boost::str(boost::format("Error creating mixer for playback of \"%1%\": %2%") % s->second.name % core->getAudio()->getErrorMessage()));
 		core->getNetwork()->sendAsync(boost::str(boost::format("%1%\t%2%\t%3%\n") % Client::Play % handleID % Client::Failure));
-		streams.erase(s);
+		eraseStream(s);
 		return;
 	}
-	if (!remote)
+	if (progress)
 	{
-		if (isModuleFile(s->second.name))
-		{
-			s->second.channel = BASS_MusicLoad(false, filePath.c_str(), 0, 0, BASS_SAMPLE_FLOAT | BASS_MUSIC_PRESCAN | BASS_MUSIC_DECODE | BASS_UNICODE, 0);
-		}
-		else
-		{
-			s->second.channel = BASS_StreamCreateFile(false, filePath.c_str(), 0, 0, BASS_SAMPLE_FLOAT | BASS_STREAM_DECODE | BASS_UNICODE);
-		}
+		s->second.channel = createProgressiveStream(s->second, filePath, progress);
+	}
+	else if (!remote)
+	{
+		s->second.channel = createFileStream(s->second, s->second.name, filePath);
 	}
 	else
 	{
@@ -389,9 +571,13 @@ void Audio::playStream(int handleID, bool pause, bool loop, bool downmix)
 	{
 		core->getProgram()->logText(boost::str(boost::format("Error creating stream for playback of \"%1%\": %2%") % s->second.name % core->getAudio()->getErrorMessage()));
 		core->getNetwork()->sendAsync(boost::str(boost::format("%1%\t%2%\t%3%\n") % Client::Play % handleID % Client::Failure));
-		streams.erase(s);
+		eraseStream(s);
 		return;
 	}
+	if (!remote)
+	{
+		core->getCache()->touchFile(s->second.name);
+	}
 	if (loop)
 	{
 		BASS_ChannelFlags(s->second.channel, BASS_SAMPLE_LOOP, BASS_SAMPLE_LOOP);
@@ -407,7 +593,7 @@ void Audio::playStream(int handleID, bool pause, bool loop, bool downmix)
 	{
 		BASS_ChannelPause(s->second.mixer);
 	}
-	core->getProgram()->logText(boost::str(boost::format("%1%: \"%2%\"") % (remote ? "Streaming" : (pause ? "Paused" : (loop ? "Looping" : "Playing"))) % s->second.name));
+	core->getProgram()->logText(boost::str(boost::format("%1%: \"%2%\"%3%") % (remote ? "Streaming" : (pause ? "Paused" : (loop ? "Looping" : "Playing"))) % s->second.name % (progress ? " (while transferring)" : "")));
 	core->getNetwork()->sendAsync(boost::str(boost::format("%1%\t%2%\t%3%\n") % Client::Play % handleID % Client::Success));
 	if (remote)
 	{
@@ -469,6 +655,36 @@ void Audio::playStream(int handleID, bool pause, bool loop, bool downmix)
 	BASS_ChannelSetSync(s->second.mixer, BASS_SYNC_FREE, 0, &onStreamFree, NULL);
 }
 
+void Audio::resumePendingPlays(int audioID)
+{
+	std::vector<int> handleIDs;
+	for (std::map<int, PendingPlay>::iterator p = pendingPlays.begin(); p != pendingPlays.end(); ++p)
+	{
+		if (p->second.audioID == audioID)
+		{
+			handleIDs.push_back(p->first);
+		}
+	}
+	for (std::vector<int>::iterator h = handleIDs.begin(); h != handleIDs.end(); ++h)
+	{
+		std::map<int, PendingPlay>::iterator p = pendingPlays.find(*h);
+		if (p == pendingPlays.end())
+		{
+			continue;
+		}
+		PendingPlay pendingPlay = p->second;
+		pendingPlays.erase(p);
+		if (pendingPlay.sequence)
+		{
+			initializeSequence(*h);
+		}
+		else
+		{
+			playStream(*h, pendingPlay.pause, pendingPlay.loop, pendingPlay.downmix);
+		}
+	}
+}
+
 void Audio::updateMeta(int handleID)
 {
 	std::map<int, Stream>::iterator s = streams.find(handleID);
@@ -564,6 +780,82 @@ void Audio::updateMeta(int handleID)
 	}
 }
 
+void CALLBACK Audio::onFileClose(void *user)
+{
+	ProgressiveFile *progressiveFile = static_cast<ProgressiveFile*>(user);
+	CloseHandle(progressiveFile->handle);
+	delete progressiveFile;
+}
+
+QWORD CALLBACK Audio::onFileLength(void *user)
+{
+	ProgressiveFile *progressiveFile = static_cast<ProgressiveFile*>(user);
+	boost::lock_guard<boost::mutex> lock(progressiveFile->progress->mutex);
+	return progressiveFile->progress->size;
+}
+
+DWORD CALLBACK Audio::onFileRead(void *buffer, DWORD length, void *user)
+{
+	ProgressiveFile *progressiveFile = static_cast<ProgressiveFile*>(user);
+	bool blocking = GetCurrentThreadId() != progressiveFile->thread;
+	boost::system_time timeout = boost::get_system_time() + boost::posix_time::milliseconds(PROGRESSIVE_TIMEOUT);
+	while (true)
+	{
+		std::size_t availableBytes = 0;
+		bool finished = false;
+		{
+			boost::unique_lock<boost::mutex> lock(progressiveFile->progress->mutex);
+			while (blocking && progressiveFile->progress->availableBytes <= progressiveFile->position && !progressiveFile->progress->finished && !*progressiveFile->cancelled)
+			{
+				if (!progressiveFile->progress->condition.timed_wait(lock, timeout))
+				{
+					break;
+				}
+			}
+			if (*progressiveFile->cancelled)
+			{
+				return 0;
+			}
+			availableBytes = progressiveFile->progress->availableBytes;
+			finished = progressiveFile->progress->finished;
+		}
+		if (availableBytes > progressiveFile->position)
+		{
+			std::size_t requestedBytes = std::min(static_cast<std::size_t>(length), availableBytes - progressiveFile->position);
+			OVERLAPPED overlapped = { 0 };
+			overlapped.Offset = static_cast<DWORD>(progressiveFile->position);
+			DWORD readBytes = 0;
+			if (ReadFile(progressiveFile->handle, buffer, static_cast<DWORD>(requestedBytes), &readBytes, &overlapped) && readBytes)
+			{
+				progressiveFile->position += readBytes;
+				return static_cast<DWORD>(readBytes);
+			}
+		}
+		if (finished)
+		{
+			return static_cast<DWORD>(-1);
+		}
+		if (!blocking || boost::get_system_time() >= timeout)
+		{
+			return 0;
+		}
+		boost::unique_lock<boost::mutex> lock(progressiveFile->progress->mutex);
+		progressiveFile->progress->condition.timed_wait(lock, boost::posix_time::milliseconds(50));
+	}
+}
+
+BOOL CALLBACK Audio::onFileSeek(QWORD offset, void *user)
+{
+	ProgressiveFile *progressiveFile = static_cast<ProgressiveFile*>(user);
+	boost::lock_guard<boost::mutex> lock(progressiveFile->progress->mutex);
+	if (offset > progressiveFile->progress->availableBytes)
+	{
+		return false;
+	}
+	progressiveFile->position = static_cast<std::size_t>(offset);
+	return true;
+}
+
 void CALLBACK Audio::onMetaChange(HSYNC handle, DWORD channel, DWORD data, void *user)
 {
 	for (std::map<int, Stream>::iterator s = core->getAudio()->streams.begin(); s != core->getAudio()->streams.end(); ++s)
@@ -596,7 +888,10 @@ void CALLBACK Audio::onStreamFree(HSYNC handle, DWORD channel, DWORD data, void
 		{
 			core->getProgram()->logText(boost::str(boost::format("Stopped: \"%1%\"") % s->second.name));
 			core->getNetwork()->sendAsync(boost::str(boost::format("%1%\t%2%\n") % Client::Stop % s->first));
+			Stream stream = s->second;
 			core->getAudio()->streams.erase(s);
+			stream.mixer = 0;
+			core->getAudio()->freeStream(stream);
 			break;
 		}
 	}
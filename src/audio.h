@@ -17,6 +17,8 @@
 #ifndef AUDIO_H
 #define AUDIO_H
 
+#include "transfer.h"
+
 #include <BASS/bass.h>
 
 #include <boost/shared_ptr.hpp>
@@ -60,6 +62,11 @@ public:
 
 		boost::shared_ptr<Sequence> sequence;
 
+		boost::shared_ptr<const char> archiveData;
+
+		boost::shared_ptr<bool> cancelled;
+		boost::shared_ptr<Transfer::Progress> progress;
+
 		HFX effects[9];
 
 		DWORD channel;
@@ -74,21 +81,58 @@ public:
 
 	bool stopped;
 
+	bool cancelPendingPlay(int handleID);
+	void cancelRead(Stream &stream);
 	void freeMemory();
 	std::string getErrorMessage();
 
 	void initializeSequence(int handleID);
 	void playNextFileInSequence(int handleID);
 	void playStream(int handleID, bool pause, bool loop, bool downmix);
+	void resumePendingPlays(int audioID);
 	void updateMeta(int handleID);
 
 	static void CALLBACK onMetaChange(HSYNC handle, DWORD channel, DWORD data, void *user);
 	static void CALLBACK onStreamEnd(HSYNC handle, DWORD channel, DWORD data, void *user);
 	static void CALLBACK onStreamFree(HSYNC handle, DWORD channel, DWORD data, void *user);
 private:
-	std::map<int, std::string> errors;
+	struct PendingPlay
+	{
+		PendingPlay();
+
+		int audioID;
+		bool downmix;
+		bool loop;
+		bool pause;
+		bool sequence;
+	};
 
+	struct ProgressiveFile
+	{
+		ProgressiveFile();
+
+		boost::shared_ptr<bool> cancelled;
+		HANDLE handle;
+		std::size_t position;
+		boost::shared_ptr<Transfer::Progress> progress;
+		DWORD thread;
+	};
+
+	std::map<int, std::string> errors;
+	std::map<int, PendingPlay> pendingPlays;
+
+	DWORD createFileStream(Stream &stream, const std::string &fileName, const std::wstring &filePath);
+	DWORD createProgressiveStream(Stream &stream, const std::wstring &filePath, const boost::shared_ptr<Transfer::Progress> &progress);
+	void eraseStream(std::map<int, Stream>::iterator s);
+	void freeChannel(DWORD &channel);
+	void freeStream(Stream &stream);
+	bool isArchivedFile(const std::string &fileName);
 	bool isModuleFile(std::string fileName);
+
+	static void CALLBACK onFileClose(void *user);
+	static QWORD CALLBACK onFileLength(void *user);
+	static DWORD CALLBACK onFileRead(void *buffer, DWORD length, void *user);
+	static BOOL CALLBACK onFileSeek(QWORD offset, void *user);
 };
 
 #endif
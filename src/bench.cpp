@@ -0,0 +1,522 @@
+/*
+ * Copyright (C) 2012 Incognito
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "digest.h"
+#include "inflater.h"
+#include "plugin.h"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/array.hpp>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono/chrono.hpp>
+#include <boost/crc.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/range/iterator_range.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <urdl/read_stream.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+	typedef boost::chrono::high_resolution_clock Clock;
+	typedef boost::iterator_range<const char*> Token;
+
+	const std::size_t BENCH_BYTES = 67108864;
+	const std::size_t BENCH_COMMANDS = 1000000;
+	const std::size_t BENCH_FILE_BYTES = 16384;
+	const std::size_t BENCH_REQUESTS = 1000;
+	const int BENCH_PASSES = 4;
+	const char *BENCH_FILE = "bench.tmp";
+
+	class BitWriter
+	{
+	public:
+		BitWriter(std::vector<char> &output) : output(output)
+		{
+			bitBuffer = 0;
+			bitCount = 0;
+		}
+
+		void code(unsigned int value, int count)
+		{
+			unsigned int reversed = 0;
+			for (int i = 0; i < count; ++i)
+			{
+				reversed = (reversed << 1) | ((value >> i) & 1);
+			}
+			write(reversed, count);
+		}
+
+		void flush()
+		{
+			if (bitCount)
+			{
+				output.push_back(static_cast<char>(bitBuffer & 0xFF));
+				bitBuffer = 0;
+				bitCount = 0;
+			}
+		}
+
+		void write(unsigned int value, int count)
+		{
+			bitBuffer |= value << bitCount;
+			bitCount += count;
+			while (bitCount >= 8)
+			{
+				output.push_back(static_cast<char>(bitBuffer & 0xFF));
+				bitBuffer >>= 8;
+				bitCount -= 8;
+			}
+		}
+	private:
+		unsigned int bitBuffer;
+		int bitCount;
+		std::vector<char> &output;
+	};
+
+	class Server
+	{
+	public:
+		Server() : acceptor(io_service, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)), body(BENCH_FILE_BYTES, 'x'), thread(boost::bind(&Server::run, this))
+		{
+		}
+
+		~Server()
+		{
+			io_service.stop();
+			thread.join();
+		}
+
+		unsigned short port() const
+		{
+			return acceptor.local_endpoint().port();
+		}
+	private:
+		void handleAccept(boost::shared_ptr<boost::asio::ip::tcp::socket> socket, const boost::system::error_code &error)
+		{
+			if (!error)
+			{
+				readRequest(socket, boost::shared_ptr<boost::asio::streambuf>(new boost::asio::streambuf));
+			}
+			startAccept();
+		}
+
+		void handleRead(boost::shared_ptr<boost::asio::ip::tcp::socket> socket, boost::shared_ptr<boost::asio::streambuf> request, const boost::system::error_code &error, std::size_t transferredBytes)
+		{
+			if (error)
+			{
+				return;
+			}
+			std::string headers(boost::asio::buffers_begin(request->data()), boost::asio::buffers_begin(request->data()) + transferredBytes);
+			request->consume(transferredBytes);
+			bool keepAlive = boost::algorithm::icontains(headers, "Connection: keep-alive");
+			boost::shared_ptr<std::string> response(new std::string(boost::str(boost::format("HTTP/1.0 200 OK\r\nContent-Length: %1%\r\nConnection: %2%\r\n\r\n") % body.size() % (keepAlive ? "keep-alive" : "close"))));
+			boost::array<boost::asio::const_buffer, 2> buffers = {{ boost::asio::buffer(*response), boost::asio::buffer(body) }};
+			boost::asio::async_write(*socket, buffers, boost::bind(&Server::handleWrite, this, socket, request, response, keepAlive, boost::asio::placeholders::error));
+		}
+
+		void handleWrite(boost::shared_ptr<boost::asio::ip::tcp::socket> socket, boost::shared_ptr<boost::asio::streambuf> request, boost::shared_ptr<std::string> response, bool keepAlive, const boost::system::error_code &error)
+		{
+			if (!error && keepAlive)
+			{
+				readRequest(socket, request);
+			}
+		}
+
+		void readRequest(const boost::shared_ptr<boost::asio::ip::tcp::socket> &socket, const boost::shared_ptr<boost::asio::streambuf> &request)
+		{
+			boost::asio::async_read_until(*socket, *request, "\r\n\r\n", boost::bind(&Server::handleRead, this, socket, request, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+		}
+
+		void run()
+		{
+			startAccept();
+			io_service.run();
+		}
+
+		void startAccept()
+		{
+			boost::shared_ptr<boost::asio::ip::tcp::socket> socket(new boost::asio::ip::tcp::socket(io_service));
+			acceptor.async_accept(*socket, boost::bind(&Server::handleAccept, this, socket, boost::asio::placeholders::error));
+		}
+
+		boost::asio::io_service io_service;
+		boost::asio::ip::tcp::acceptor acceptor;
+		std::string body;
+		boost::thread thread;
+	};
+
+	bool fetchFiles(const std::string &url, bool keepAlive, Clock::duration &elapsed)
+	{
+		boost::asio::io_service io_service;
+		boost::shared_ptr<urdl::read_stream> stream;
+		std::vector<char> buffer(PROGRESSIVE_BUFFER);
+		Clock::time_point start = Clock::now();
+		for (std::size_t r = 0; r < BENCH_REQUESTS; ++r)
+		{
+			if (!stream || !keepAlive)
+			{
+				stream.reset(new urdl::read_stream(io_service));
+				stream->set_option(urdl::http::keep_alive(keepAlive));
+			}
+			else if (!stream->is_reusable())
+			{
+				return false;
+			}
+			boost::system::error_code error;
+			stream->open(url, error);
+			std::size_t fileBytes = 0;
+			while (!error)
+			{
+				fileBytes += stream->read_some(boost::asio::buffer(buffer), error);
+			}
+			if (error != boost::asio::error::eof || fileBytes != BENCH_FILE_BYTES)
+			{
+				return false;
+			}
+		}
+		elapsed = Clock::now() - start;
+		return true;
+	}
+
+	double getCountRate(std::size_t count, Clock::duration elapsed)
+	{
+		double seconds = boost::chrono::duration_cast<boost::chrono::duration<double> >(elapsed).count();
+		return seconds > 0.0 ? static_cast<double>(count) / seconds : 0.0;
+	}
+
+	double getRate(std::size_t bytes, Clock::duration elapsed)
+	{
+		double seconds = boost::chrono::duration_cast<boost::chrono::duration<double> >(elapsed).count();
+		return seconds > 0.0 ? static_cast<double>(bytes) / 1048576.0 / seconds : 0.0;
+	}
+
+	void fillData(std::vector<char> &data)
+	{
+		boost::uint32_t seed = 0x12345678;
+		std::size_t i = 0;
+		while (i < data.size())
+		{
+			seed = seed * 1103515245 + 12345;
+			if ((seed >> 16) & 3)
+			{
+				data[i++] = static_cast<char>(seed >> 24);
+				continue;
+			}
+			std::size_t runBytes = std::min<std::size_t>(258, data.size() - i);
+			std::fill(data.begin() + i, data.begin() + i + runBytes, static_cast<char>(seed >> 8));
+			i += runBytes;
+		}
+	}
+
+	std::size_t fillCommands(std::vector<char> &data)
+	{
+		std::size_t commands = 0;
+		for (int handleID = 1; ; ++handleID)
+		{
+			std::string line = boost::str(boost::format("15\t%1%\t%2%.25\t-%3%.5\t12.75\t50\n") % handleID % (handleID * 7) % (handleID * 3));
+			if (handleID % 4 == 0)
+			{
+				line = boost::str(boost::format("12\t%1%\t%2%\n") % handleID % (handleID % 100));
+			}
+			if (data.size() + line.size() > MAX_BUFFER)
+			{
+				break;
+			}
+			data.insert(data.end(), line.begin(), line.end());
+			++commands;
+		}
+		return commands;
+	}
+
+	void compressData(const std::vector<char> &data, std::vector<char> &output)
+	{
+		static const unsigned char header[] = { 0x1F, 0x8B, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF };
+		output.assign(header, header + sizeof(header));
+		BitWriter writer(output);
+		writer.write(1, 1);
+		writer.write(1, 2);
+		std::size_t i = 0;
+		while (i < data.size())
+		{
+			if (i && i + 258 <= data.size() && data[i] == data[i - 1] && std::count(data.begin() + i, data.begin() + i + 258, data[i - 1]) == 258)
+			{
+				writer.code(0xC5, 8);
+				writer.code(0, 5);
+				i += 258;
+				continue;
+			}
+			unsigned int value = static_cast<unsigned char>(data[i++]);
+			if (value < 144)
+			{
+				writer.code(0x30 + value, 8);
+			}
+			else
+			{
+				writer.code(0x190 + value - 144, 9);
+			}
+		}
+		writer.code(0, 7);
+		writer.flush();
+		boost::crc_32_type crc;
+		crc.process_bytes(&data[0], data.size());
+		boost::uint32_t trailer[] = { crc.checksum(), static_cast<boost::uint32_t>(data.size()) };
+		for (int t = 0; t < 2; ++t)
+		{
+			for (int b = 0; b < 4; ++b)
+			{
+				output.push_back(static_cast<char>((trailer[t] >> (b * 8)) & 0xFF));
+			}
+		}
+	}
+
+	void sendData(boost::shared_ptr<boost::asio::ip::tcp::socket> socket, const std::vector<char> &data)
+	{
+		boost::system::error_code error;
+		for (int p = 0; p < BENCH_PASSES && !error; ++p)
+		{
+			boost::asio::write(*socket, boost::asio::buffer(data), error);
+		}
+		socket->close(error);
+	}
+
+	bool receiveFile(const std::vector<char> &data, bool staged, Clock::duration &elapsed)
+	{
+		boost::asio::io_service io_service;
+		boost::asio::ip::tcp::acceptor acceptor(io_service, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+		boost::asio::ip::tcp::socket socket(io_service);
+		boost::shared_ptr<boost::asio::ip::tcp::socket> sender(new boost::asio::ip::tcp::socket(io_service));
+		boost::system::error_code error;
+		socket.connect(acceptor.local_endpoint(), error);
+		if (!error)
+		{
+			acceptor.accept(*sender, error);
+		}
+		if (error)
+		{
+			return false;
+		}
+		boost::thread thread(boost::bind(&sendData, sender, boost::cref(data)));
+		boost::array<char, MAX_BUFFER> buffer;
+		std::vector<char> block(WRITE_BUFFER);
+		std::size_t blockBytes = 0, receivedBytes = 0;
+		Clock::time_point start = Clock::now();
+		std::fstream handle(BENCH_FILE, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		handle.rdbuf()->pubsetbuf(NULL, 0);
+		while (!error)
+		{
+			std::size_t transferredBytes = 0;
+			if (staged)
+			{
+				transferredBytes = socket.read_some(boost::asio::buffer(buffer.c_array(), std::min(buffer.size(), block.size() - blockBytes)), error);
+				std::memcpy(&block[blockBytes], buffer.data(), transferredBytes);
+			}
+			else
+			{
+				transferredBytes = socket.read_some(boost::asio::buffer(&block[blockBytes], block.size() - blockBytes), error);
+			}
+			blockBytes += transferredBytes;
+			receivedBytes += transferredBytes;
+			if (blockBytes == block.size() || (error && blockBytes))
+			{
+				handle.seekp(static_cast<std::streamoff>(receivedBytes - blockBytes));
+				handle.write(&block[0], static_cast<std::streamsize>(blockBytes));
+				handle.flush();
+				blockBytes = 0;
+			}
+		}
+		bool result = error == boost::asio::error::eof && receivedBytes == data.size() * BENCH_PASSES && !handle.fail();
+		handle.close();
+		elapsed = Clock::now() - start;
+		socket.close(error);
+		thread.join();
+		std::remove(BENCH_FILE);
+		return result;
+	}
+
+	bool benchDigest(const std::vector<char> &data)
+	{
+		boost::uint32_t expected = 0;
+		Clock::time_point start = Clock::now();
+		for (int p = 0; p < BENCH_PASSES; ++p)
+		{
+			boost::crc_32_type crc;
+			for (std::size_t i = 0; i < data.size(); i += CHECKSUM_BUFFER)
+			{
+				crc.process_bytes(&data[i], std::min<std::size_t>(CHECKSUM_BUFFER, data.size() - i));
+			}
+			expected = crc.checksum();
+		}
+		Clock::duration baseline = Clock::now() - start;
+		boost::uint32_t checksum = 0;
+		start = Clock::now();
+		for (int p = 0; p < BENCH_PASSES; ++p)
+		{
+			Digest digest;
+			for (std::size_t i = 0; i < data.size(); i += CHECKSUM_BUFFER)
+			{
+				digest.process(&data[i], std::min<std::size_t>(CHECKSUM_BUFFER, data.size() - i));
+			}
+			checksum = digest.checksum();
+		}
+		Clock::duration elapsed = Clock::now() - start;
+		std::cout << boost::str(boost::format("crc32:    boost %1$.1f MB/s, digest %2$.1f MB/s (%3$X)") % getRate(data.size() * BENCH_PASSES, baseline) % getRate(data.size() * BENCH_PASSES, elapsed) % checksum) << std::endl;
+		if (checksum != expected)
+		{
+			std::cout << boost::str(boost::format("crc32:    checksum mismatch (expected %1$X)") % expected) << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	bool benchInflater(const std::vector<char> &data)
+	{
+		std::vector<char> compressed;
+		compressData(data, compressed);
+		std::vector<char> output;
+		output.reserve(WRITE_BUFFER + PROGRESSIVE_BUFFER);
+		bool result = true;
+		Clock::time_point start = Clock::now();
+		for (int p = 0; p < BENCH_PASSES && result; ++p)
+		{
+			Inflater inflater(Inflater::Gzip);
+			std::size_t outputBytes = 0;
+			for (std::size_t i = 0; i < compressed.size() && !inflater.finished() && !inflater.failed(); i += PROGRESSIVE_BUFFER)
+			{
+				inflater.process(&compressed[i], std::min<std::size_t>(PROGRESSIVE_BUFFER, compressed.size() - i), output);
+				if (output.size() > data.size() - outputBytes || !std::equal(output.begin(), output.end(), data.begin() + outputBytes))
+				{
+					break;
+				}
+				outputBytes += output.size();
+				output.clear();
+			}
+			result = inflater.finished() && outputBytes == data.size();
+		}
+		Clock::duration elapsed = Clock::now() - start;
+		std::cout << boost::str(boost::format("inflate:  %1$.1f MB/s output from %2% compressed bytes") % getRate(data.size() * BENCH_PASSES, elapsed) % compressed.size()) << std::endl;
+		if (!result)
+		{
+			std::cout << "inflate:  output mismatch" << std::endl;
+		}
+		return result;
+	}
+
+	bool benchParser()
+	{
+		std::vector<char> data;
+		std::size_t commands = fillCommands(data);
+		std::size_t reads = BENCH_COMMANDS / commands;
+		std::size_t baselineChecksum = 0;
+		std::vector<std::string> messageTokens, stringTokens;
+		Clock::time_point start = Clock::now();
+		for (std::size_t r = 0; r < reads; ++r)
+		{
+			std::string buffer(&data[0], data.size());
+			boost::algorithm::erase_last(buffer, "\n");
+			boost::algorithm::split(messageTokens, buffer, boost::algorithm::is_any_of("\n"));
+			for (std::vector<std::string>::iterator i = messageTokens.begin(); i != messageTokens.end(); ++i)
+			{
+				boost::algorithm::split(stringTokens, *i, boost::algorithm::is_any_of("\t"));
+				baselineChecksum += boost::lexical_cast<int>(stringTokens.at(0)) + stringTokens.size();
+			}
+		}
+		Clock::duration baseline = Clock::now() - start;
+		std::size_t checksum = 0;
+		std::vector<Token> commandTokens;
+		start = Clock::now();
+		for (std::size_t r = 0; r < reads; ++r)
+		{
+			const char *begin = &data[0], *end = &data[0] + data.size();
+			while (begin != end)
+			{
+				const char *separator = std::find(begin, end, '\n');
+				commandTokens.clear();
+				for (const char *token = begin; ; )
+				{
+					const char *tokenEnd = std::find(token, separator, '\t');
+					commandTokens.push_back(Token(token, tokenEnd));
+					if (tokenEnd == separator)
+					{
+						break;
+					}
+					token = tokenEnd + 1;
+				}
+				checksum += boost::lexical_cast<int>(commandTokens.at(0)) + commandTokens.size();
+				begin = separator == end ? end : separator + 1;
+			}
+		}
+		Clock::duration elapsed = Clock::now() - start;
+		std::cout << boost::str(boost::format("parse:    split %1$.0f commands/s, in place %2$.0f commands/s") % getCountRate(reads * commands, baseline) % getCountRate(reads * commands, elapsed)) << std::endl;
+		if (checksum != baselineChecksum)
+		{
+			std::cout << "parse:    token mismatch" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	bool benchTransfer()
+	{
+		Server server;
+		std::string url = boost::str(boost::format("http://127.0.0.1:%1%/audio.mp3") % server.port());
+		Clock::duration baseline, elapsed;
+		if (!fetchFiles(url, false, baseline) || !fetchFiles(url, true, elapsed))
+		{
+			std::cout << boost::str(boost::format("transfer: error requesting \"%1%\"") % url) << std::endl;
+			return false;
+		}
+		std::cout << boost::str(boost::format("transfer: per-request %1$.0f files/s, keep-alive %2$.0f files/s (%3% byte files over loopback)") % getCountRate(BENCH_REQUESTS, baseline) % getCountRate(BENCH_REQUESTS, elapsed) % BENCH_FILE_BYTES) << std::endl;
+		return true;
+	}
+
+	bool benchWriter(const std::vector<char> &data)
+	{
+		Clock::duration baseline, elapsed;
+		if (!receiveFile(data, true, baseline) || !receiveFile(data, false, elapsed))
+		{
+			std::cout << boost::str(boost::format("receive:  error receiving into \"%1%\"") % BENCH_FILE) << std::endl;
+			return false;
+		}
+		std::cout << boost::str(boost::format("receive:  staged %1$.1f MB/s, direct %2$.1f MB/s (loopback socket into write blocks)") % getRate(data.size() * BENCH_PASSES, baseline) % getRate(data.size() * BENCH_PASSES, elapsed)) << std::endl;
+		return true;
+	}
+}
+
+int main()
+{
+	std::vector<char> data(BENCH_BYTES);
+	fillData(data);
+	bool result = benchDigest(data);
+	result = benchInflater(data) && result;
+	result = benchParser() && result;
+	result = benchTransfer() && result;
+	result = benchWriter(data) && result;
+	return result ? 0 : 1;
+}
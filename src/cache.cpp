@@ -0,0 +1,389 @@
+/*
+ * Copyright (C) 2012 Incognito
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cache.h"
+
+#include "core.h"
+#include "plugin.h"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <SimpleIni/SimpleIni.h>
+
+#include <algorithm>
+#include <ctime>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <windows.h>
+
+namespace
+{
+	typedef std::pair<DWORD, boost::uint64_t> FileID;
+
+	FileID getFileID(const BY_HANDLE_FILE_INFORMATION &information)
+	{
+		return FileID(information.dwVolumeSerialNumber, (static_cast<boost::uint64_t>(information.nFileIndexHigh) << 32) | information.nFileIndexLow);
+	}
+
+	bool getFileInformation(const std::wstring &filePath, BY_HANDLE_FILE_INFORMATION &information)
+	{
+		HANDLE file = CreateFileW(filePath.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		BOOL result = GetFileInformationByHandle(file, &information);
+		CloseHandle(file);
+		return result != 0;
+	}
+}
+
+Cache::Cache(boost::asio::io_service &io_service) : io_service(io_service), usageTimer(io_service)
+{
+	evicting = false;
+	evictionPending = false;
+	usagePending = false;
+	work.reset(new boost::asio::io_service::work(workService));
+	worker = boost::thread(boost::bind(&Cache::runWorker, this));
+}
+
+Cache::~Cache()
+{
+	work.reset();
+	workService.stop();
+	worker.join();
+	if (!pendingUsage.empty())
+	{
+		recordUsage(pendingUsage);
+	}
+}
+
+Cache::Entry::Entry()
+{
+	pinned = false;
+	size = 0;
+	time = 0;
+}
+
+void Cache::enforceQuota()
+{
+	if (!core->getProgram()->settings->packQuota)
+	{
+		return;
+	}
+	if (evicting)
+	{
+		evictionPending = true;
+		return;
+	}
+	evicting = true;
+	flushUsage();
+	workService.post(boost::bind(&Cache::evictFiles, this, core->getProgram()->savePath, core->getProgram()->downloadPath, core->getProgram()->settings->packQuota));
+}
+
+void Cache::flushUsage()
+{
+	if (usagePending)
+	{
+		boost::system::error_code error;
+		usageTimer.cancel(error);
+		usagePending = false;
+	}
+	if (pendingUsage.empty())
+	{
+		return;
+	}
+	std::map<std::wstring, std::map<std::wstring, std::time_t> > usage;
+	usage.swap(pendingUsage);
+	workService.post(boost::bind(&Cache::recordUsage, this, usage));
+}
+
+void Cache::touchFile(const std::string &name)
+{
+	if (core->getProgram()->downloadPath.empty())
+	{
+		return;
+	}
+	pendingUsage[core->getProgram()->downloadPath][core->strtowstr(name)] = std::time(NULL);
+	if (!usagePending)
+	{
+		usagePending = true;
+		usageTimer.expires_from_now(boost::posix_time::milliseconds(JOURNAL_INTERVAL));
+		usageTimer.async_wait(boost::bind(&Cache::handleUsageTimer, this, boost::asio::placeholders::error));
+	}
+}
+
+void Cache::handleEvictFiles(std::size_t evictedFiles)
+{
+	if (evictedFiles)
+	{
+		core->getProgram()->logText(boost::str(boost::format("Evicted %1% least recently used file(s) to keep audio packs within %2% MB") % evictedFiles % (core->getProgram()->settings->packQuota / 1048576)));
+	}
+	evicting = false;
+	if (evictionPending)
+	{
+		evictionPending = false;
+		enforceQuota();
+	}
+}
+
+void Cache::handleUsageTimer(const boost::system::error_code &error)
+{
+	if (error)
+	{
+		return;
+	}
+	usagePending = false;
+	flushUsage();
+}
+
+void Cache::evictFiles(std::wstring savePath, std::wstring packPath, boost::uintmax_t quota)
+{
+	std::map<FileID, Entry> entries;
+	boost::uintmax_t totalSize = 0;
+	boost::system::error_code error;
+	std::wstring packsPath = boost::str(boost::wformat(L"%1%\\audiopacks") % savePath);
+	for (boost::filesystem::directory_iterator p(packsPath, error); p != boost::filesystem::directory_iterator(); p.increment(error))
+	{
+		if (error)
+		{
+			break;
+		}
+		if (!boost::filesystem::is_directory(p->status()))
+		{
+			continue;
+		}
+		bool current = boost::algorithm::iequals(p->path().wstring(), packPath);
+		std::map<std::string, std::time_t> usage;
+		loadUsage(p->path().wstring(), usage);
+		std::time_t packTime = 0;
+		for (std::map<std::string, std::time_t>::iterator u = usage.begin(); u != usage.end(); ++u)
+		{
+			packTime = std::max(packTime, u->second);
+		}
+		boost::system::error_code fileError;
+		for (boost::filesystem::directory_iterator f(p->path(), fileError); f != boost::filesystem::directory_iterator(); f.increment(fileError))
+		{
+			if (fileError)
+			{
+				break;
+			}
+			BY_HANDLE_FILE_INFORMATION information;
+			if (!boost::filesystem::is_regular_file(f->status()) || !getFileInformation(f->path().wstring(), information))
+			{
+				continue;
+			}
+			std::pair<std::map<FileID, Entry>::iterator, bool> e = entries.insert(std::make_pair(getFileID(information), Entry()));
+			if (e.second)
+			{
+				e.first->second.size = (static_cast<boost::uintmax_t>(information.nFileSizeHigh) << 32) | information.nFileSizeLow;
+				totalSize += e.first->second.size;
+			}
+			e.first->second.paths.push_back(f->path().wstring());
+			std::string name = core->wstrtostr(f->path().filename().wstring());
+			if (current || boost::algorithm::iequals(f->path().extension().wstring(), L".ini"))
+			{
+				e.first->second.pinned = true;
+				continue;
+			}
+			boost::system::error_code timeError;
+			std::time_t time = boost::filesystem::last_write_time(f->path(), timeError);
+			if (boost::algorithm::iequals(name, "audio.pak"))
+			{
+				time = std::max(time, packTime);
+			}
+			else
+			{
+				std::map<std::string, std::time_t>::iterator u = usage.find(name);
+				if (u != usage.end())
+				{
+					time = u->second;
+				}
+			}
+			e.first->second.time = std::max(e.first->second.time, time);
+		}
+	}
+	std::wstring cachePath = boost::str(boost::wformat(L"%1%\\cache") % savePath);
+	for (boost::filesystem::directory_iterator s(cachePath, error); s != boost::filesystem::directory_iterator(); s.increment(error))
+	{
+		if (error)
+		{
+			break;
+		}
+		if (!boost::filesystem::is_directory(s->status()))
+		{
+			boost::system::error_code removeError;
+			boost::filesystem::remove(s->path(), removeError);
+			continue;
+		}
+		boost::system::error_code fileError;
+		for (boost::filesystem::directory_iterator c(s->path(), fileError); c != boost::filesystem::directory_iterator(); c.increment(fileError))
+		{
+			if (fileError)
+			{
+				break;
+			}
+			BY_HANDLE_FILE_INFORMATION information;
+			if (!boost::filesystem::is_regular_file(c->status()) || !getFileInformation(c->path().wstring(), information))
+			{
+				continue;
+			}
+			std::pair<std::map<FileID, Entry>::iterator, bool> e = entries.insert(std::make_pair(getFileID(information), Entry()));
+			if (e.second)
+			{
+				e.first->second.size = (static_cast<boost::uintmax_t>(information.nFileSizeHigh) << 32) | information.nFileSizeLow;
+				boost::system::error_code timeError;
+				e.first->second.time = boost::filesystem::last_write_time(c->path(), timeError);
+				totalSize += e.first->second.size;
+			}
+			e.first->second.paths.push_back(c->path().wstring());
+		}
+	}
+	std::size_t evictedFiles = 0;
+	if (totalSize > quota)
+	{
+		std::multimap<std::time_t, Entry*> candidates;
+		for (std::map<FileID, Entry>::iterator e = entries.begin(); e != entries.end(); ++e)
+		{
+			if (!e->second.pinned)
+			{
+				candidates.insert(std::make_pair(e->second.time, &e->second));
+			}
+		}
+		std::map<std::wstring, std::vector<std::string> > evictedNames;
+		for (std::multimap<std::time_t, Entry*>::iterator c = candidates.begin(); c != candidates.end() && totalSize > quota; ++c)
+		{
+			bool removed = true;
+			for (std::vector<std::wstring>::iterator p = c->second->paths.begin(); p != c->second->paths.end(); ++p)
+			{
+				boost::system::error_code removeError;
+				boost::filesystem::path path(*p);
+				if (!boost::filesystem::remove(path, removeError) && removeError)
+				{
+					removed = false;
+					continue;
+				}
+				if (!boost::algorithm::iequals(path.parent_path().parent_path().wstring(), cachePath))
+				{
+					evictedNames[path.parent_path().wstring()].push_back(core->wstrtostr(path.filename().wstring()));
+				}
+			}
+			if (removed)
+			{
+				totalSize -= c->second->size;
+				++evictedFiles;
+			}
+		}
+		for (std::map<std::wstring, std::vector<std::string> >::iterator n = evictedNames.begin(); n != evictedNames.end(); ++n)
+		{
+			bool empty = true;
+			boost::system::error_code fileError;
+			for (boost::filesystem::directory_iterator f(n->first, fileError); f != boost::filesystem::directory_iterator(); f.increment(fileError))
+			{
+				if (fileError || !boost::algorithm::iequals(f->path().extension().wstring(), L".ini"))
+				{
+					empty = false;
+					break;
+				}
+			}
+			if (empty)
+			{
+				boost::filesystem::remove_all(n->first, fileError);
+			}
+			else
+			{
+				removeUsage(n->first, n->second);
+			}
+		}
+	}
+	io_service.post(boost::bind(&Cache::handleEvictFiles, this, evictedFiles));
+}
+
+void Cache::loadUsage(const std::wstring &packPath, std::map<std::string, std::time_t> &usage)
+{
+	std::wstring filePath = boost::str(boost::wformat(L"%1%\\usage.ini") % packPath);
+	CSimpleIniW ini(true, false, true);
+	SI_Error error = ini.LoadFile(filePath.c_str());
+	if (error < 0)
+	{
+		return;
+	}
+	CSimpleIniW::TNamesDepend sections;
+	ini.GetAllSections(sections);
+	for (CSimpleIniW::TNamesDepend::iterator s = sections.begin(); s != sections.end(); ++s)
+	{
+		const wchar_t *value = ini.GetValue(s->pItem, L"time");
+		if (!value)
+		{
+			continue;
+		}
+		try
+		{
+			usage[core->wstrtostr(s->pItem)] = boost::lexical_cast<std::time_t>(value);
+		}
+		catch (boost::bad_lexical_cast &)
+		{
+			continue;
+		}
+	}
+}
+
+void Cache::recordUsage(std::map<std::wstring, std::map<std::wstring, std::time_t> > usage)
+{
+	for (std::map<std::wstring, std::map<std::wstring, std::time_t> >::iterator p = usage.begin(); p != usage.end(); ++p)
+	{
+		std::wstring filePath = boost::str(boost::wformat(L"%1%\\usage.ini") % p->first);
+		CSimpleIniW ini(true, false, true);
+		ini.LoadFile(filePath.c_str());
+		for (std::map<std::wstring, std::time_t>::iterator u = p->second.begin(); u != p->second.end(); ++u)
+		{
+			ini.SetValue(u->first.c_str(), L"time", boost::lexical_cast<std::wstring>(u->second).c_str());
+		}
+		ini.SaveFile(filePath.c_str());
+	}
+}
+
+void Cache::removeUsage(const std::wstring &packPath, const std::vector<std::string> &names)
+{
+	std::wstring filePath = boost::str(boost::wformat(L"%1%\\usage.ini") % packPath);
+	CSimpleIniW ini(true, false, true);
+	if (ini.LoadFile(filePath.c_str()) < 0)
+	{
+		return;
+	}
+	for (std::vector<std::string>::const_iterator n = names.begin(); n != names.end(); ++n)
+	{
+		ini.Delete(core->strtowstr(*n).c_str(), NULL);
+	}
+	ini.SaveFile(filePath.c_str());
+}
+
+void Cache::runWorker()
+{
+	boost::system::error_code error;
+	workService.run(error);
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2012 Incognito
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+class Cache
+{
+public:
+	Cache(boost::asio::io_service &io_service);
+	~Cache();
+
+	void enforceQuota();
+	void flushUsage();
+	void touchFile(const std::string &name);
+private:
+	struct Entry
+	{
+		Entry();
+
+		std::vector<std::wstring> paths;
+		bool pinned;
+		boost::uintmax_t size;
+		std::time_t time;
+	};
+
+	void handleEvictFiles(std::size_t evictedFiles);
+	void handleUsageTimer(const boost::system::error_code &error);
+
+	void evictFiles(std::wstring savePath, std::wstring packPath, boost::uintmax_t quota);
+	void loadUsage(const std::wstring &packPath, std::map<std::string, std::time_t> &usage);
+	void recordUsage(std::map<std::wstring, std::map<std::wstring, std::time_t> > usage);
+	void removeUsage(const std::wstring &packPath, const std::vector<std::string> &names);
+	void runWorker();
+
+	bool evicting;
+	bool evictionPending;
+	bool usagePending;
+
+	std::map<std::wstring, std::map<std::wstring, std::time_t> > pendingUsage;
+
+	boost::asio::io_service &io_service;
+	boost::asio::deadline_timer usageTimer;
+	boost::scoped_ptr<boost::asio::io_service::work> work;
+	boost::thread worker;
+	boost::asio::io_service workService;
+};
+
+#endif
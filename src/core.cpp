@@ -17,8 +17,10 @@
 #include "core.h"
 
 #include <boost/asio.hpp>
+#include <boost/format.hpp>
 #include <boost/scoped_ptr.hpp>
 
+#include <limits>
 #include <string>
 
 #include <windows.h>
@@ -29,8 +31,32 @@ Core::Core()
 {
 	program.reset(new Program);
 	audio.reset(new Audio);
+	cache.reset(new Cache(io_service));
 	game.reset(new Game(io_service));
 	network.reset(new Network(io_service));
+	transfer.reset(new Transfer(io_service));
+}
+
+std::string Core::outputFileSize(std::size_t bytes)
+{
+	std::string fileSize;
+	if (bytes == std::numeric_limits<std::size_t>::max())
+	{
+		fileSize = "Unknown Size";
+	}
+	else if (bytes >= 1048576)
+	{
+		fileSize = boost::str(boost::format("%.1lf MB") % (static_cast<float>(bytes) / 1048576.0f));
+	}
+	else if (bytes >= 1024)
+	{
+		fileSize = boost::str(boost::format("%.1lf KB") % (static_cast<float>(bytes) / 1024.0f));
+	}
+	else
+	{
+		fileSize = boost::str(boost::format("%1% bytes") % bytes);
+	}
+	return fileSize;
 }
 
 std::wstring Core::strtowstr(const std::string &input)
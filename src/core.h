@@ -18,9 +18,11 @@
 #define CORE_H
 
 #include "audio.h"
+#include "cache.h"
 #include "game.h"
 #include "network.h"
 #include "program.h"
+#include "transfer.h"
 
 #include <boost/asio.hpp>
 #include <boost/scoped_ptr.hpp>
@@ -37,6 +39,11 @@ public:
 		return audio.get();
 	}
 
+	inline Cache *getCache()
+	{
+		return cache.get();
+	}
+
 	inline Game *getGame()
 	{
 		return game.get();
@@ -52,15 +59,23 @@ public:
 		return program.get();
 	}
 
+	inline Transfer *getTransfer()
+	{
+		return transfer.get();
+	}
+
+	std::string outputFileSize(std::size_t bytes);
 	std::wstring strtowstr(const std::string &input);
 	std::string wstrtostr(const std::wstring &input);
 
 	boost::asio::io_service io_service;
 private:
 	boost::scoped_ptr<Audio> audio;
+	boost::scoped_ptr<Cache> cache;
 	boost::scoped_ptr<Game> game;
 	boost::scoped_ptr<Network> network;
 	boost::scoped_ptr<Program> program;
+	boost::scoped_ptr<Transfer> transfer;
 };
 
 extern boost::scoped_ptr<Core> core;
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2012 Incognito
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "digest.h"
+
+#include <boost/cstdint.hpp>
+
+#include <cstddef>
+#include <cstring>
+
+#include <emmintrin.h>
+#include <wmmintrin.h>
+
+#if defined _MSC_VER
+	#include <intrin.h>
+#else
+	#include <cpuid.h>
+#endif
+
+namespace
+{
+	struct Tables
+	{
+		Tables()
+		{
+			for (boost::uint32_t i = 0; i < 256; ++i)
+			{
+				boost::uint32_t value = i;
+				for (int j = 0; j < 8; ++j)
+				{
+					value = (value >> 1) ^ (0xEDB88320 & (0 - (value & 1)));
+				}
+				table[0][i] = value;
+			}
+			for (boost::uint32_t i = 0; i < 256; ++i)
+			{
+				for (int j = 1; j < 8; ++j)
+				{
+					table[j][i] = (table[j - 1][i] >> 8) ^ table[0][table[j - 1][i] & 0xFF];
+				}
+			}
+			int info[4] = { 0 };
+			#if defined _MSC_VER
+				__cpuid(info, 1);
+			#else
+				__cpuid(1, info[0], info[1], info[2], info[3]);
+			#endif
+			carryless = (info[2] & (1 << 1)) && (info[3] & (1 << 26));
+		}
+
+		bool carryless;
+		boost::uint32_t table[8][256];
+	};
+
+	const Tables tables;
+}
+
+Digest::Digest()
+{
+	crc = 0xFFFFFFFF;
+}
+
+void Digest::process(const char *data, std::size_t size)
+{
+	const unsigned char *buffer = reinterpret_cast<const unsigned char*>(data);
+	if (tables.carryless && size >= 64)
+	{
+		std::size_t blockSize = size & ~static_cast<std::size_t>(15);
+		crc = processCarryless(buffer, blockSize, crc);
+		buffer += blockSize;
+		size -= blockSize;
+	}
+	crc = processSliced(buffer, size, crc);
+}
+
+boost::uint32_t Digest::checksum() const
+{
+	return ~crc;
+}
+
+boost::uint32_t Digest::processCarryless(const unsigned char *data, std::size_t size, boost::uint32_t crc)
+{
+	// Folds 64 bytes at a time with carry-less multiplication, then reduces
+	// the remainder with a Barrett reduction (Intel, "Fast CRC Computation
+	// for Generic Polynomials Using PCLMULQDQ Instruction"). The size must be
+	// at least 64 and a multiple of 16.
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+	x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+	x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16));
+	x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32));
+	x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+	x0 = _mm_setr_epi32(0x54442BD4, 0x00000001, 0xC6E41596, 0x00000001);
+	data += 64;
+	size -= 64;
+	while (size >= 64)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48)));
+		data += 64;
+		size -= 64;
+	}
+	x0 = _mm_setr_epi32(0x751997D0, 0x00000001, 0xCCAA009E, 0x00000000);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+	while (size >= 16)
+	{
+		x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		data += 16;
+		size -= 16;
+	}
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x0 = _mm_setr_epi32(0x63CD6124, 0x00000001, 0x00000000, 0x00000000);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	x0 = _mm_setr_epi32(0xDB710641, 0x00000001, 0xF7011641, 0x00000001);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return static_cast<boost::uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(x1, 4)));
+}
+
+boost::uint32_t Digest::processSliced(const unsigned char *data, std::size_t size, boost::uint32_t crc)
+{
+	while (size >= 8)
+	{
+		boost::uint32_t low = 0, high = 0;
+		std::memcpy(&low, data, 4);
+		std::memcpy(&high, data + 4, 4);
+		low ^= crc;
+		crc = tables.table[7][low & 0xFF] ^ tables.table[6][(low >> 8) & 0xFF] ^ tables.table[5][(low >> 16) & 0xFF] ^ tables.table[4][low >> 24] ^ tables.table[3][high & 0xFF] ^ tables.table[2][(high >> 8) & 0xFF] ^ tables.table[1][(high >> 16) & 0xFF] ^ tables.table[0][high >> 24];
+		data += 8;
+		size -= 8;
+	}
+	while (size--)
+	{
+		crc = (crc >> 8) ^ tables.table[0][(crc ^ *data++) & 0xFF];
+	}
+	return crc;
+}
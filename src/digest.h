@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2012 Incognito
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <boost/cstdint.hpp>
+
+#include <cstddef>
+
+class Digest
+{
+public:
+	Digest();
+
+	void process(const char *data, std::size_t size);
+	boost::uint32_t checksum() const;
+private:
+	boost::uint32_t processCarryless(const unsigned char *data, std::size_t size, boost::uint32_t crc);
+	boost::uint32_t processSliced(const unsigned char *data, std::size_t size, boost::uint32_t crc);
+
+	boost::uint32_t crc;
+};
+
+#endif
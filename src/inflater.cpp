@@ -0,0 +1,609 @@
+/*
+ * Copyright (C) 2012 Incognito
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "inflater.h"
+
+#include "digest.h"
+
+#include <boost/cstdint.hpp>
+
+#include <cstddef>
+#include <vector>
+
+namespace
+{
+	const short lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	const short lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	const unsigned short distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	const short distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+	const short codeOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+}
+
+Inflater::Inflater(int format) : format(format), window(32768)
+{
+	adler = 1;
+	bitBuffer = 0;
+	bitCount = 0;
+	exhausted = false;
+	inputPosition = 0;
+	lastBlock = false;
+	savedBitBuffer = 0;
+	savedBitCount = 0;
+	savedPosition = 0;
+	state = format == Raw ? BlockHeader : Header;
+	storedBytes = 0;
+	totalBytes = 0;
+}
+
+std::size_t Inflater::process(const char *data, std::size_t size, std::vector<char> &output)
+{
+	if (state == Done || state == Failed)
+	{
+		return 0;
+	}
+	input.insert(input.end(), data, data + size);
+	std::size_t checkedBytes = output.size();
+	while (state != Done && state != Failed)
+	{
+		exhausted = false;
+		if (state == Trailer && output.size() > checkedBytes)
+		{
+			update(&output[checkedBytes], output.size() - checkedBytes);
+			checkedBytes = output.size();
+		}
+		bool result = false;
+		switch (state)
+		{
+			case Header:
+			{
+				result = readHeader();
+				break;
+			}
+			case BlockHeader:
+			{
+				result = readBlockHeader();
+				break;
+			}
+			case Stored:
+			{
+				result = readStored(output);
+				break;
+			}
+			case Codes:
+			{
+				result = readCodes(output);
+				break;
+			}
+			case Trailer:
+			{
+				result = readTrailer();
+				break;
+			}
+		}
+		if (!result)
+		{
+			state = Failed;
+			return size;
+		}
+		if (exhausted)
+		{
+			break;
+		}
+	}
+	if (output.size() > checkedBytes)
+	{
+		update(&output[checkedBytes], output.size() - checkedBytes);
+	}
+	std::size_t remainingBytes = input.size() - inputPosition;
+	if (state == Done)
+	{
+		input.clear();
+		inputPosition = 0;
+		return remainingBytes < size ? size - remainingBytes : 0;
+	}
+	input.erase(input.begin(), input.begin() + inputPosition);
+	inputPosition = 0;
+	return size;
+}
+
+bool Inflater::failed() const
+{
+	return state == Failed;
+}
+
+bool Inflater::finished() const
+{
+	return state == Done;
+}
+
+bool Inflater::build(Huffman &huffman, const short *lengths, int size)
+{
+	for (int i = 0; i < 16; ++i)
+	{
+		huffman.count[i] = 0;
+	}
+	for (int i = 0; i < size; ++i)
+	{
+		++huffman.count[lengths[i]];
+	}
+	if (huffman.count[0] == size)
+	{
+		return true;
+	}
+	int left = 1;
+	for (int i = 1; i < 16; ++i)
+	{
+		left <<= 1;
+		left -= huffman.count[i];
+		if (left < 0)
+		{
+			return false;
+		}
+	}
+	short offsets[16];
+	offsets[1] = 0;
+	for (int i = 1; i < 15; ++i)
+	{
+		offsets[i + 1] = offsets[i] + huffman.count[i];
+	}
+	for (int i = 0; i < size; ++i)
+	{
+		if (lengths[i])
+		{
+			huffman.symbol[offsets[lengths[i]]++] = static_cast<short>(i);
+		}
+	}
+	return true;
+}
+
+unsigned int Inflater::bits(int count)
+{
+	while (bitCount < count)
+	{
+		if (inputPosition == input.size())
+		{
+			exhausted = true;
+			return 0;
+		}
+		bitBuffer |= static_cast<unsigned int>(input[inputPosition++]) << bitCount;
+		bitCount += 8;
+	}
+	unsigned int value = bitBuffer & ((1U << count) - 1);
+	bitBuffer >>= count;
+	bitCount -= count;
+	return value;
+}
+
+int Inflater::decode(const Huffman &huffman)
+{
+	int code = 0, first = 0, index = 0;
+	for (int i = 1; i < 16; ++i)
+	{
+		code |= static_cast<int>(bits(1));
+		if (exhausted)
+		{
+			return -1;
+		}
+		int count = huffman.count[i];
+		if (code - count < first)
+		{
+			return huffman.symbol[index + (code - first)];
+		}
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+void Inflater::emit(unsigned char value, std::vector<char> &output)
+{
+	window[totalBytes & 32767] = value;
+	output.push_back(static_cast<char>(value));
+	++totalBytes;
+}
+
+bool Inflater::readBlockHeader()
+{
+	save();
+	lastBlock = bits(1) != 0;
+	unsigned int type = bits(2);
+	if (exhausted)
+	{
+		restore();
+		return true;
+	}
+	switch (type)
+	{
+		case 0:
+		{
+			bitBuffer >>= bitCount & 7;
+			bitCount -= bitCount & 7;
+			unsigned int length = bits(16);
+			unsigned int complement = bits(16);
+			if (exhausted)
+			{
+				restore();
+				return true;
+			}
+			if (length != (~complement & 0xFFFF))
+			{
+				return false;
+			}
+			storedBytes = length;
+			state = Stored;
+			return true;
+		}
+		case 1:
+		{
+			short lengths[320];
+			for (int i = 0; i < 144; ++i)
+			{
+				lengths[i] = 8;
+			}
+			for (int i = 144; i < 256; ++i)
+			{
+				lengths[i] = 9;
+			}
+			for (int i = 256; i < 280; ++i)
+			{
+				lengths[i] = 7;
+			}
+			for (int i = 280; i < 288; ++i)
+			{
+				lengths[i] = 8;
+			}
+			for (int i = 288; i < 318; ++i)
+			{
+				lengths[i] = 5;
+			}
+			build(lengthCode, lengths, 288);
+			build(distanceCode, lengths + 288, 30);
+			state = Codes;
+			return true;
+		}
+		case 2:
+		{
+			int lengthCount = static_cast<int>(bits(5)) + 257;
+			int distanceCount = static_cast<int>(bits(5)) + 1;
+			int codeCount = static_cast<int>(bits(4)) + 4;
+			if (exhausted)
+			{
+				restore();
+				return true;
+			}
+			if (lengthCount > 286 || distanceCount > 30)
+			{
+				return false;
+			}
+			short lengths[320] = { 0 };
+			for (int i = 0; i < codeCount; ++i)
+			{
+				lengths[codeOrder[i]] = static_cast<short>(bits(3));
+			}
+			if (exhausted)
+			{
+				restore();
+				return true;
+			}
+			Huffman code;
+			if (!build(code, lengths, 19))
+			{
+				return false;
+			}
+			int index = 0;
+			while (index < lengthCount + distanceCount)
+			{
+				int symbol = decode(code);
+				if (exhausted)
+				{
+					restore();
+					return true;
+				}
+				if (symbol < 0)
+				{
+					return false;
+				}
+				if (symbol < 16)
+				{
+					lengths[index++] = static_cast<short>(symbol);
+					continue;
+				}
+				short length = 0;
+				int repeat = 0;
+				if (symbol == 16)
+				{
+					if (!index)
+					{
+						return false;
+					}
+					length = lengths[index - 1];
+					repeat = 3 + static_cast<int>(bits(2));
+				}
+				else if (symbol == 17)
+				{
+					repeat = 3 + static_cast<int>(bits(3));
+				}
+				else
+				{
+					repeat = 11 + static_cast<int>(bits(7));
+				}
+				if (exhausted)
+				{
+					restore();
+					return true;
+				}
+				if (index + repeat > lengthCount + distanceCount)
+				{
+					return false;
+				}
+				while (repeat--)
+				{
+					lengths[index++] = length;
+				}
+			}
+			if (!lengths[256])
+			{
+				return false;
+			}
+			if (!build(lengthCode, lengths, lengthCount) || !build(distanceCode, lengths + lengthCount, distanceCount))
+			{
+				return false;
+			}
+			state = Codes;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Inflater::readCodes(std::vector<char> &output)
+{
+	for (;;)
+	{
+		save();
+		int symbol = decode(lengthCode);
+		if (exhausted)
+		{
+			restore();
+			return true;
+		}
+		if (symbol < 0)
+		{
+			return false;
+		}
+		if (symbol < 256)
+		{
+			emit(static_cast<unsigned char>(symbol), output);
+			continue;
+		}
+		if (symbol == 256)
+		{
+			state = lastBlock ? Trailer : BlockHeader;
+			return true;
+		}
+		symbol -= 257;
+		if (symbol >= 29)
+		{
+			return false;
+		}
+		std::size_t length = lengthBase[symbol] + bits(lengthExtra[symbol]);
+		symbol = decode(distanceCode);
+		if (exhausted)
+		{
+			restore();
+			return true;
+		}
+		if (symbol < 0 || symbol >= 30)
+		{
+			return false;
+		}
+		std::size_t distance = distanceBase[symbol] + bits(distanceExtra[symbol]);
+		if (exhausted)
+		{
+			restore();
+			return true;
+		}
+		if (distance > totalBytes)
+		{
+			return false;
+		}
+		while (length--)
+		{
+			emit(window[(totalBytes - distance) & 32767], output);
+		}
+	}
+}
+
+bool Inflater::readHeader()
+{
+	save();
+	if (format == Deflate)
+	{
+		unsigned int method = bits(8);
+		unsigned int flags = bits(8);
+		if (exhausted)
+		{
+			restore();
+			return true;
+		}
+		restore();
+		format = (method & 0x0F) == 8 && !(((method << 8) | flags) % 31) ? Zlib : Raw;
+	}
+	if (format == Raw)
+	{
+		state = BlockHeader;
+		return true;
+	}
+	if (format == Zlib)
+	{
+		unsigned int method = bits(8);
+		unsigned int flags = bits(8);
+		if (exhausted)
+		{
+			restore();
+			return true;
+		}
+		if ((method & 0x0F) != 8 || (((method << 8) | flags) % 31) || (flags & 0x20))
+		{
+			return false;
+		}
+		state = BlockHeader;
+		return true;
+	}
+	unsigned int first = bits(8);
+	unsigned int second = bits(8);
+	unsigned int method = bits(8);
+	unsigned int flags = bits(8);
+	for (int i = 0; i < 6; ++i)
+	{
+		bits(8);
+	}
+	if (flags & 0x04)
+	{
+		unsigned int length = bits(16);
+		while (length-- && !exhausted)
+		{
+			bits(8);
+		}
+	}
+	if (flags & 0x08)
+	{
+		while (bits(8) && !exhausted);
+	}
+	if (flags & 0x10)
+	{
+		while (bits(8) && !exhausted);
+	}
+	if (flags & 0x02)
+	{
+		bits(16);
+	}
+	if (exhausted)
+	{
+		restore();
+		return true;
+	}
+	if (first != 0x1F || second != 0x8B || method != 8)
+	{
+		return false;
+	}
+	state = BlockHeader;
+	return true;
+}
+
+bool Inflater::readStored(std::vector<char> &output)
+{
+	while (storedBytes && bitCount >= 8)
+	{
+		emit(static_cast<unsigned char>(bits(8)), output);
+		--storedBytes;
+	}
+	while (storedBytes && inputPosition < input.size())
+	{
+		emit(input[inputPosition++], output);
+		--storedBytes;
+	}
+	if (storedBytes)
+	{
+		exhausted = true;
+		return true;
+	}
+	state = lastBlock ? Trailer : BlockHeader;
+	return true;
+}
+
+bool Inflater::readTrailer()
+{
+	save();
+	bitBuffer >>= bitCount & 7;
+	bitCount -= bitCount & 7;
+	if (format == Gzip)
+	{
+		boost::uint32_t checksum = bits(16);
+		checksum |= bits(16) << 16;
+		boost::uint32_t size = bits(16);
+		size |= bits(16) << 16;
+		if (exhausted)
+		{
+			restore();
+			return true;
+		}
+		if (checksum != digest.checksum() || size != static_cast<boost::uint32_t>(totalBytes))
+		{
+			return false;
+		}
+	}
+	else if (format == Zlib)
+	{
+		boost::uint32_t checksum = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			checksum = (checksum << 8) | bits(8);
+		}
+		if (exhausted)
+		{
+			restore();
+			return true;
+		}
+		if (checksum != adler)
+		{
+			return false;
+		}
+	}
+	state = Done;
+	return true;
+}
+
+void Inflater::restore()
+{
+	bitBuffer = savedBitBuffer;
+	bitCount = savedBitCount;
+	inputPosition = savedPosition;
+}
+
+void Inflater::save()
+{
+	savedBitBuffer = bitBuffer;
+	savedBitCount = bitCount;
+	savedPosition = inputPosition;
+}
+
+void Inflater::update(const char *data, std::size_t size)
+{
+	if (format == Gzip)
+	{
+		digest.process(data, size);
+	}
+	else if (format == Zlib)
+	{
+		boost::uint32_t a = adler & 0xFFFF, b = adler >> 16;
+		while (size)
+		{
+			std::size_t count = size < 5552 ? size : 5552;
+			size -= count;
+			while (count--)
+			{
+				a += static_cast<unsigned char>(*data++);
+				b += a;
+			}
+			a %= 65521;
+			b %= 65521;
+		}
+		adler = (b << 16) | a;
+	}
+}
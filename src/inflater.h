@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2012 Incognito
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INFLATER_H
+#define INFLATER_H
+
+#include "digest.h"
+
+#include <boost/cstdint.hpp>
+
+#include <cstddef>
+#include <vector>
+
+class Inflater
+{
+public:
+	enum Formats
+	{
+		Deflate,
+		Gzip,
+		Raw,
+		Zlib
+	};
+
+	Inflater(int format);
+
+	std::size_t process(const char *data, std::size_t size, std::vector<char> &output);
+
+	bool failed() const;
+	bool finished() const;
+private:
+	enum States
+	{
+		Header,
+		BlockHeader,
+		Stored,
+		Codes,
+		Trailer,
+		Done,
+		Failed
+	};
+
+	struct Huffman
+	{
+		short count[16];
+		short symbol[288];
+	};
+
+	bool build(Huffman &huffman, const short *lengths, int size);
+	unsigned int bits(int count);
+	int decode(const Huffman &huffman);
+	void emit(unsigned char value, std::vector<char> &output);
+
+	bool readBlockHeader();
+	bool readCodes(std::vector<char> &output);
+	bool readHeader();
+	bool readStored(std::vector<char> &output);
+	bool readTrailer();
+
+	void restore();
+	void save();
+	void update(const char *data, std::size_t size);
+
+	boost::uint32_t adler;
+	unsigned int bitBuffer;
+	int bitCount;
+	Huffman distanceCode;
+	Digest digest;
+	bool exhausted;
+	int format;
+	std::vector<unsigned char> input;
+	std::size_t inputPosition;
+	bool lastBlock;
+	Huffman lengthCode;
+	unsigned int savedBitBuffer;
+	int savedBitCount;
+	std::size_t savedPosition;
+	int state;
+	std::size_t storedBytes;
+	std::size_t totalBytes;
+	std::vector<unsigned char> window;
+};
+
+#endif
@@ -23,45 +23,64 @@
 #include <BASS/bassmix.h>
 
 #include <boost/algorithm/string.hpp>
-#include <boost/array.hpp>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
-#include <boost/crc.hpp>
 #include <boost/cstdint.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/range/iterator_range.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 
-#include <urdl/read_stream.hpp>
-
-#include <fstream>
-#include <limits>
+#include <algorithm>
+#include <cstring>
 #include <map>
 #include <set>
 #include <string>
-#include <queue>
 #include <vector>
 
-Network::Network(boost::asio::io_service &io_service) : clientSocket(io_service), connectTimer(io_service), mainTimer(io_service), readStream(io_service), resolver(io_service), timeoutTimer(io_service)
+Network::Network(boost::asio::io_service &io_service) : clientSocket(io_service), connectTimer(io_service), mainTimer(io_service), resolver(io_service), timeoutTimer(io_service)
 {
 	attempts = 0;
 	authenticated = false;
 	connected = false;
+	binaryMessage = false;
 	connecting = false;
+	features = 0;
 	lastCommunication = 0;
+	pendingCount = 0;
+	receivedBytes = 0;
+	sentCount = 0;
+	statistics.reset(new Statistics);
 	writeInProgress = false;
 	startMainTimer();
 }
 
+Network::Statistics::Statistics()
+{
+	bytes = 0;
+	messages = 0;
+	writes = 0;
+}
+
+Network::Manifest::Manifest()
+{
+	files = 0;
+	missingFiles = 0;
+	pendingFiles = 0;
+}
+
 void Network::handleConnect(const boost::system::error_code &error, boost::asio::ip::tcp::resolver::iterator endpoint_iterator)
 {
 	if (!error)
 	{
 		core->getProgram()->logText(boost::str(boost::format("Connected to %1%") % endpoint_iterator->endpoint()));
-		sendAsync(boost::str(boost::format("%1%\t%2%\t%3%\n") % Client::Authenticate % core->getProgram()->name % PLUGIN_VERSION));
-		clientSocket.async_read_some(boost::asio::buffer(receivedData), boost::bind(&Network::handleRead, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+		statistics.reset(new Statistics);
+		sendAsync(boost::str(boost::format("%1%\t%2%\t%3%\t%4%\n") % Client::Authenticate % core->getProgram()->name % PLUGIN_VERSION % Features::Supported));
+		features = 0;
+		receivedBytes = 0;
+		readAsync();
 		connecting = false;
 		connected = true;
 	}
@@ -131,59 +150,16 @@ void Network::handleMainTimer(const boost::system::error_code &error)
 	}
 }
 
-void Network::handleOpenStream(const boost::system::error_code &error)
+void Network::handleManifestFile(boost::shared_ptr<Manifest> manifest, boost::shared_ptr<Transfer::File> file, bool result)
 {
-	if (!error)
-	{
-		if (file)
-		{
-			file->size = readStream.content_length();
-			std::fstream fileHandle(file->path.c_str(), std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
-			if (fileHandle)
-			{
-				if (file->size == fileHandle.tellg())
-				{
-					core->getProgram()->logText(boost::str(boost::format("Remote file \"%1%\" passed file size check") % file->url));
-					sendAsync(boost::str(boost::format("%1%\t%2%\n") % Client::Transfer % Client::Check));
-					core->getAudio()->files.insert(std::make_pair(file->id, file->name));
-					file.reset();
-				}
-				fileHandle.close();
-			}
-			if (file)
-			{
-				file->handle.open(file->path.c_str(), std::ios_base::out | std::ios_base::binary);
-				if (!file->handle)
-				{
-					core->getProgram()->logText(boost::str(boost::format("Error opening \"%1%\" for writing") % file->name));
-					sendAsync(boost::str(boost::format("%1%\t%2%\n") % Client::Transfer % Client::Error));
-					file.reset();
-				}
-			}
-		}
-	}
-	else
+	if (!result)
 	{
-		if (file)
-		{
-			core->getProgram()->logText(boost::str(boost::format("Error opening stream for remote file \"%1%\": %2%") % file->url % error.message()));
-			sendAsync(boost::str(boost::format("%1%\t%2%\n") % Client::Transfer % Client::Error));
-			file.reset();
-		}
+		manifest->buffer.append(boost::str(boost::format("\t%1%") % file->id));
+		++manifest->missingFiles;
 	}
-	if (clientSocket.is_open() && readStream.is_open())
+	if (!--manifest->pendingFiles)
 	{
-		if (file)
-		{
-			core->getProgram()->logText(boost::str(boost::format("Transferring remote file \"%1%\" (%2%)...") % file->url % outputFileSize(file->size)));
-			readStream.async_read_some(boost::asio::buffer(file->buffer.c_array(), file->buffer.size()), boost::bind(&Network::handleReadStream, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
-		}
-		else
-		{
-			clientSocket.async_read_some(boost::asio::buffer(receivedData), boost::bind(&Network::handleRead, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
-			boost::system::error_code error;
-			readStream.close(error);
-		}
+		finishManifest(manifest);
 	}
 }
 
@@ -191,138 +167,27 @@ void Network::handleRead(const boost::system::error_code &error, std::size_t tra
 {
 	if (!error)
 	{
-		std::string buffer(receivedData);
-		buffer.resize(transferredBytes);
-		boost::algorithm::erase_last(buffer, "\n");
-		boost::algorithm::split(messageTokens, buffer, boost::algorithm::is_any_of("\n"));
-		if (messageTokens.empty())
-		{
-			parseBuffer(buffer);
-		}
-		else
-		{
-			for (std::vector<std::string>::iterator i = messageTokens.begin(); i != messageTokens.end(); ++i)
-			{
-				parseBuffer(*i);
-			}
-		}
-		if (file)
-		{
-			if (file->url.empty())
-			{
-				return;
-			}
-		}
-		clientSocket.async_read_some(boost::asio::buffer(receivedData), boost::bind(&Network::handleRead, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
-		lastCommunication = GetTickCount();
-	}
-	else
-	{
-		closeConnection();
-	}
-}
-
-void Network::handleReadFile(const boost::system::error_code &error, std::size_t transferredBytes)
-{
-	if (!error)
-	{
-		if (file)
-		{
-			if (transferredBytes)
-			{
-				if (boost::algorithm::equals(file->buffer.c_array(), "CANCEL"))
-				{
-					core->getProgram()->logText(boost::str(boost::format("Transfer of local file \"%1%\" canceled server-side") % file->name));
-					file.reset();
-				}
-				else
-				{
-					file->handle.write(file->buffer.c_array(), static_cast<std::streamsize>(transferredBytes));
-					if (file->handle.tellp() >= static_cast<std::streamsize>(file->size))
-					{
-						core->getProgram()->logText(boost::str(boost::format("Transfer of local file \"%1%\" complete") % file->name));
-						core->getAudio()->files.insert(std::make_pair(file->id, file->name));
-						file.reset();
-					}
-				}
-			}
-			else
-			{
-				core->getProgram()->logText(boost::str(boost::format("Error reading data for local file \"%1%\" during transfer: No data received") % file->name));
-				sendAsync(boost::str(boost::format("%1%\t%2%\n") % Client::Transfer % Client::Error));
-				file.reset();
-			}
-		}
-	}
-	else
-	{
-		if (file)
+		receivedBytes += transferredBytes;
+		processReceivedData();
+		if (receivedBytes > MAX_MESSAGE)
 		{
-			core->getProgram()->logText(boost::str(boost::format("Error reading data for local file \"%1%\" during transfer: %2%") % file->name % error.message()));
-			sendAsync(boost::str(boost::format("%1%\t%2%\n") % Client::Transfer % Client::Error));
-			file.reset();
+			core->getProgram()->logText("Error reading data from server: Message too long");
+			closeConnection();
+			return;
 		}
-	}
-	if (clientSocket.is_open())
-	{
-		if (file)
+		if (core->getTransfer()->localFile && !(features & Features::Multiplexed))
 		{
-			clientSocket.async_read_some(boost::asio::buffer(file->buffer.c_array(), file->buffer.size()), boost::bind(&Network::handleReadFile, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+			core->getTransfer()->readLocalData(transferredBytes, boost::bind(&Network::readAsync, this));
 		}
 		else
 		{
-			clientSocket.async_read_some(boost::asio::buffer(receivedData), boost::bind(&Network::handleRead, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+			readAsync();
 		}
 		lastCommunication = GetTickCount();
 	}
-}
-
-void Network::handleReadStream(const boost::system::error_code &error, std::size_t transferredBytes)
-{
-	if (!error)
-	{
-		if (file)
-		{
-			if (transferredBytes)
-			{
-				file->handle.write(file->buffer.c_array(), static_cast<std::streamsize>(transferredBytes));
-			}
-			else
-			{
-				core->getProgram()->logText(boost::str(boost::format("Error reading stream for remote file \"%1%\" during transfer: No data received") % file->url));
-				sendAsync(boost::str(boost::format("%1%\t%2%\n") % Client::Transfer % Client::Error));
-				file.reset();
-				boost::system::error_code error;
-				readStream.close(error);
-			}
-		}
-	}
 	else
 	{
-		if (file)
-		{
-			if (error != boost::asio::error::eof)
-			{
-				core->getProgram()->logText(boost::str(boost::format("Error reading stream for remote file \"%1%\" during transfer: %2%") % file->url % error.message()));
-				sendAsync(boost::str(boost::format("%1%\t%2%\n") % Client::Transfer % Client::Error));
-			}
-			else
-			{
-				core->getProgram()->logText(boost::str(boost::format("Transfer of remote file \"%1%\" complete") % file->url));
-				sendAsync(boost::str(boost::format("%1%\t%2%\n") % Client::Transfer % Client::Remote));
-				core->getAudio()->files.insert(std::make_pair(file->id, file->name));
-			}
-			file.reset();
-			boost::system::error_code error;
-			readStream.close(error);
-		}
-	}
-	if (readStream.is_open())
-	{
-		if (file)
-		{
-			readStream.async_read_some(boost::asio::buffer(file->buffer.c_array(), file->buffer.size()), boost::bind(&Network::handleReadStream, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
-		}
+		closeConnection();
 	}
 }
 
@@ -347,35 +212,64 @@ void Network::handleTimeoutTimer(const boost::system::error_code &error)
 	}
 }
 
-void Network::handleWrite(const boost::system::error_code &error)
+void Network::handleWrite(const boost::system::error_code &error, std::size_t transferredBytes)
 {
 	writeInProgress = false;
 	if (!error)
 	{
-		if (!pendingMessages.empty())
+		statistics->bytes += transferredBytes;
+		statistics->messages += sentCount;
+		++statistics->writes;
+		sentCount = 0;
+		if (pendingCount)
 		{
-			sendAsync(pendingMessages.front());
-			pendingMessages.pop();
+			writeAsync();
 		}
 	}
 	else
 	{
-		pendingMessages = std::queue<std::string>();
+		pendingCount = 0;
+		sentCount = 0;
+	}
+}
+
+void Network::readAsync()
+{
+	if (receivedData.size() - receivedBytes < MAX_BUFFER)
+	{
+		receivedData.resize(std::max(receivedData.size() * 2, receivedBytes + MAX_BUFFER));
 	}
+	clientSocket.async_read_some(boost::asio::buffer(&receivedData[receivedBytes], receivedData.size() - receivedBytes), boost::bind(&Network::handleRead, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
 }
 
 void Network::sendAsync(const std::string &buffer)
 {
-	if (writeInProgress)
+	if (pendingCount < pendingMessages.size())
 	{
-		pendingMessages.push(buffer);
+		pendingMessages[pendingCount].assign(buffer);
 	}
 	else
 	{
-		sentData = buffer;
-		writeInProgress = true;
-		boost::asio::async_write(clientSocket, boost::asio::buffer(sentData, sentData.length()), boost::bind(&Network::handleWrite, this, boost::asio::placeholders::error));
+		pendingMessages.push_back(buffer);
+	}
+	++pendingCount;
+	if (!writeInProgress)
+	{
+		writeAsync();
+	}
+}
+
+void Network::writeAsync()
+{
+	pendingMessages.swap(sentMessages);
+	std::swap(pendingCount, sentCount);
+	sentBuffers.clear();
+	for (std::size_t i = 0; i < sentCount; ++i)
+	{
+		sentBuffers.push_back(boost::asio::buffer(sentMessages[i]));
 	}
+	writeInProgress = true;
+	boost::asio::async_write(clientSocket, sentBuffers, boost::bind(&Network::handleWrite, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
 }
 
 void Network::startAsync()
@@ -393,14 +287,15 @@ void Network::stopAsync()
 		{
 			authenticated = false;
 			connected = false;
-			file.reset();
-			pendingMessages = std::queue<std::string>();
+			core->getTransfer()->stop();
+			core->getCache()->flushUsage();
+			pendingCount = 0;
+			sentCount = 0;
 			writeInProgress = false;
 		}
 		boost::system::error_code error;
 		clientSocket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, error);
 		clientSocket.close(error);
-		readStream.close(error);
 		resolver.cancel();
 		stopConnectTimer();
 		stopTimeoutTimer();
@@ -457,30 +352,34 @@ void Network::closeConnection()
 	if (connected)
 	{
 		core->getProgram()->logText("Disconnected from server");
+		core->getProgram()->logText(boost::str(boost::format("Sent %1% messages (%2%) in %3% writes") % statistics->messages % core->outputFileSize(statistics->bytes) % statistics->writes));
 		core->getProgram()->downloadPath.clear();
 	}
 	core->getAudio()->freeMemory();
 	stopAsync();
 }
 
-void Network::parseBuffer(const std::string &buffer)
+void Network::parseBuffer(const char *begin, const char *end)
 {
-	if (buffer.empty())
+	if (begin == end)
 	{
 		sendAsync("\n");
 		return;
 	}
-	boost::algorithm::split(commandTokens, buffer, boost::algorithm::is_any_of("\t"));
-	if (commandTokens.empty())
-	{
-		commandTokens.push_back(buffer);
-	}
-	for (std::vector<std::string>::iterator i = commandTokens.begin(); i != commandTokens.end(); ++i)
+	commandTokens.clear();
+	for (const char *token = begin; ; )
 	{
-		if (i->empty())
+		const char *separator = std::find(token, end, '\t');
+		if (separator == token)
 		{
 			return;
 		}
+		commandTokens.push_back(Token(token, separator));
+		if (separator == end)
+		{
+			break;
+		}
+		token = separator + 1;
 	}
 	int command = 0;
 	try
@@ -491,6 +390,88 @@ void Network::parseBuffer(const std::string &buffer)
 	{
 		return;
 	}
+	binaryMessage = false;
+	dispatchCommand(command);
+}
+
+void Network::parseBinaryBuffer(const char *begin, const char *end)
+{
+	int command = static_cast<unsigned char>(*begin) & ~BINARY_FRAME_FLAG;
+	if (command == Server::TransferData)
+	{
+		if (features & Features::Multiplexed)
+		{
+			performTransferData(begin + BINARY_HEADER_SIZE, end);
+		}
+		return;
+	}
+	if (!(features & Features::Binary))
+	{
+		return;
+	}
+	const char *layout = NULL;
+	switch (command)
+	{
+		case Server::Pause:
+		case Server::Resume:
+		case Server::Stop:
+		case Server::Restart:
+		case Server::Remove3DPosition:
+		case Server::SetRadioStation:
+		{
+			layout = "i";
+			break;
+		}
+		case Server::GetPosition:
+		case Server::SetPosition:
+		case Server::SetFX:
+		case Server::RemoveFX:
+		{
+			layout = "ii";
+			break;
+		}
+		case Server::SetVolume:
+		{
+			layout = "if";
+			break;
+		}
+		case Server::Set3DPosition:
+		{
+			layout = "iffff";
+			break;
+		}
+		case Server::StopRadio:
+		{
+			layout = "";
+			break;
+		}
+	}
+	if (!layout)
+	{
+		return;
+	}
+	commandTokens.clear();
+	commandTokens.push_back(Token(begin, begin + 1));
+	const char *field = begin + BINARY_HEADER_SIZE;
+	for (const char *type = layout; *type; ++type)
+	{
+		if (end - field < 4)
+		{
+			return;
+		}
+		commandTokens.push_back(Token(field, field + 4));
+		field += 4;
+	}
+	if (field != end)
+	{
+		return;
+	}
+	binaryMessage = true;
+	dispatchCommand(command);
+}
+
+void Network::dispatchCommand(int command)
+{
 	switch (command)
 	{
 		case Server::Connect:
@@ -569,29 +550,100 @@ void Network::parseBuffer(const std::string &buffer)
 		{
 			return performStopRadio();
 		}
+		case Server::Features:
+		{
+			return performFeatures();
+		}
+		case Server::Manifest:
+		{
+			return performManifest();
+		}
 	}
 }
 
-std::string Network::outputFileSize(std::size_t bytes)
+template<typename T> T Network::getArgument(std::size_t index)
 {
-	std::string fileSize;
-	if (bytes == std::numeric_limits<std::size_t>::max())
+	if (!binaryMessage)
 	{
-		fileSize = "Unknown Size";
+		return boost::lexical_cast<T>(commandTokens.at(index));
 	}
-	else if (bytes >= 1048576)
+	T value;
+	decodeField(commandTokens.at(index), value);
+	return value;
+}
+
+void Network::decodeField(const Token &token, float &value)
+{
+	boost::uint32_t bits = 0;
+	decodeField(token, bits);
+	std::memcpy(&value, &bits, sizeof(value));
+}
+
+void Network::decodeField(const Token &token, int &value)
+{
+	boost::uint32_t bits = 0;
+	decodeField(token, bits);
+	value = static_cast<boost::int32_t>(bits);
+}
+
+void Network::decodeField(const Token &token, boost::uint32_t &value)
+{
+	if (token.size() != 4)
 	{
-		fileSize = boost::str(boost::format("%.1lf MB") % (static_cast<float>(bytes) / 1048576.0f));
+		throw boost::bad_lexical_cast();
 	}
-	else if (bytes >= 1024)
+	const unsigned char *bytes = reinterpret_cast<const unsigned char*>(token.begin());
+	value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<boost::uint32_t>(bytes[3]) << 24);
+}
+
+void Network::processReceivedData()
+{
+	std::size_t position = 0;
+	while (position < receivedBytes)
 	{
-		fileSize = boost::str(boost::format("%.1lf KB") % (static_cast<float>(bytes) / 1024.0f));
+		const char *begin = &receivedData[position], *end = &receivedData[0] + receivedBytes;
+		if (core->getTransfer()->localFile && !(features & Features::Multiplexed))
+		{
+			static const char cancelMessage[] = "CANCEL";
+			std::size_t cancelLength = sizeof(cancelMessage) - 1;
+			if (static_cast<std::size_t>(end - begin) >= cancelLength && std::equal(cancelMessage, cancelMessage + cancelLength, begin))
+			{
+				core->getTransfer()->cancelLocalFile();
+				position += cancelLength;
+				continue;
+			}
+			position += core->getTransfer()->receiveLocalData(begin, end - begin);
+			continue;
+		}
+		if ((features & (Features::Binary | Features::Multiplexed)) && (static_cast<unsigned char>(*begin) & BINARY_FRAME_FLAG))
+		{
+			if (static_cast<std::size_t>(end - begin) < BINARY_HEADER_SIZE)
+			{
+				break;
+			}
+			std::size_t length = static_cast<unsigned char>(begin[1]) | (static_cast<unsigned char>(begin[2]) << 8);
+			if (static_cast<std::size_t>(end - begin) < BINARY_HEADER_SIZE + length)
+			{
+				break;
+			}
+			position += BINARY_HEADER_SIZE + length;
+			parseBinaryBuffer(begin, begin + BINARY_HEADER_SIZE + length);
+			continue;
+		}
+		const char *separator = std::find(begin, end, '\n');
+		if (separator == end)
+		{
+			break;
+		}
+		position += (separator - begin) + 1;
+		parseBuffer(begin, separator);
 	}
-	else
+	if (position)
 	{
-		fileSize = boost::str(boost::format("%1% bytes") % bytes);
+		position = std::min(position, receivedBytes);
+		std::copy(receivedData.begin() + position, receivedData.begin() + receivedBytes, receivedData.begin());
+		receivedBytes -= position;
 	}
-	return fileSize;
 }
 
 void Network::performConnect()
@@ -615,11 +667,94 @@ void Network::performConnect()
 			}
 		}
 		core->getProgram()->logText(boost::str(boost::format("Download path set to \"audiopacks\\%1%\"") % commandTokens.at(1)));
-		core->getProgram()->downloadPath = boost::str(boost::wformat(L"%1%\\audiopacks\\%2%") % core->getProgram()->savePath % core->strtowstr(commandTokens.at(1)));
+		core->getProgram()->downloadPath = boost::str(boost::wformat(L"%1%\\audiopacks\\%2%") % core->getProgram()->savePath % core->strtowstr(boost::copy_range<std::string>(commandTokens.at(1))));
 		if (!boost::filesystem::exists(core->getProgram()->downloadPath))
 		{
 			boost::filesystem::create_directories(core->getProgram()->downloadPath);
 		}
+		core->getTransfer()->loadArchive();
+		core->getTransfer()->loadChecksums();
+		core->getTransfer()->loadJournal();
+		core->getCache()->enforceQuota();
+	}
+}
+
+void Network::performFeatures()
+{
+	if (commandTokens.size() != 2)
+	{
+		return;
+	}
+	try
+	{
+		features = boost::lexical_cast<unsigned int>(commandTokens.at(1)) & Features::Supported;
+	}
+	catch (boost::bad_lexical_cast &)
+	{
+		return;
+	}
+	if (!(features & Features::Multiplexed))
+	{
+		features &= ~(Features::Concurrent | Features::Delta);
+	}
+	if (features & Features::Binary)
+	{
+		core->getProgram()->logText("Binary protocol enabled");
+	}
+	if (features & Features::Multiplexed)
+	{
+		core->getProgram()->logText("Multiplexed file transfers enabled");
+	}
+	if (features & Features::Concurrent)
+	{
+		core->getProgram()->logText("Concurrent file transfers enabled");
+	}
+	if (features & Features::Resume)
+	{
+		core->getProgram()->logText("Resumable file transfers enabled");
+	}
+	if (features & Features::Compressed)
+	{
+		core->getProgram()->logText("Compressed file transfers enabled");
+	}
+	if (features & Features::Prefetch)
+	{
+		core->getProgram()->logText("Background file prefetching enabled");
+	}
+}
+
+void Network::performManifest()
+{
+	if (!(features & Features::Manifest) || (commandTokens.size() - 1) % 5)
+	{
+		return;
+	}
+	boost::shared_ptr<Manifest> manifest(new Manifest);
+	manifest->buffer = boost::str(boost::format("%1%") % Client::Manifest);
+	manifest->files = (commandTokens.size() - 1) / 5;
+	std::vector<boost::shared_ptr<Transfer::File> > files;
+	for (std::size_t i = 1; i < commandTokens.size(); i += 5)
+	{
+		boost::shared_ptr<Transfer::File> file(new Transfer::File);
+		if (parseFile(file, i) && file->url.empty())
+		{
+			files.push_back(file);
+		}
+		else
+		{
+			manifest->buffer.append(boost::str(boost::format("\t%1%") % commandTokens.at(i + 1)));
+			++manifest->missingFiles;
+		}
+	}
+	if (files.empty())
+	{
+		finishManifest(manifest);
+		return;
+	}
+	manifest->pendingFiles = files.size();
+	for (std::vector<boost::shared_ptr<Transfer::File> >::iterator f = files.begin(); f != files.end(); ++f)
+	{
+		core->getTransfer()->checkFile(*f, boost::bind(&Network::handleManifestFile, this, manifest, *f, _1));
 	}
 }
 
@@ -638,145 +773,32 @@ void Network::performName()
 	{
 		return;
 	}
-	core->getProgram()->name = commandTokens.at(1);
+	core->getProgram()->name.assign(commandTokens.at(1).begin(), commandTokens.at(1).end());
 }
 
 void Network::performTransfer()
 {
-	if (commandTokens.size() == 6)
+	if (commandTokens.size() == 6 || (commandTokens.size() == 7 && (features & Features::Prefetch)))
 	{
-		if (core->getProgram()->downloadPath.empty())
+		boost::shared_ptr<Transfer::File> file(new Transfer::File);
+		if (!parseFile(file, 1))
 		{
-			core->getProgram()->logText(boost::str(boost::format("Transfer of file \"%1%\" rejected (no download path specified)") % commandTokens.at(3)));
-			sendAsync(boost::str(boost::format("%1%\t%2%\n") % Client::Transfer % Client::Error));
+			core->getTransfer()->sendReply(file, Client::Error);
 			return;
 		}
-		bool remote = false, transferable = false;
-		file.reset(new File);
-		try
-		{
-			transferable = boost::lexical_cast<bool>(commandTokens.at(1));
-			file->id = boost::lexical_cast<int>(commandTokens.at(2));
-			file->size = boost::lexical_cast<std::size_t>(commandTokens.at(4));
-		}
-		catch (boost::bad_lexical_cast &)
+		if (commandTokens.size() == 7)
 		{
-			sendAsync(boost::str(boost::format("%1%\t%2%\n") % Client::Transfer % Client::Error));
-			file.reset();
-			return;
-		}
-		if (boost::algorithm::istarts_with(commandTokens.at(3), "http://"))
-		{
-			remote = true;
-			file->url = commandTokens.at(3);
-		}
-		if (remote)
-		{
-			std::size_t fileLocation = commandTokens.at(3).find_last_of('/');
-			file->name = commandTokens.at(3).substr(fileLocation + 1);
-		}
-		else
-		{
-			file->name = commandTokens.at(3);
-		}
-		bool result = false;
-		for (std::set<std::string>::iterator i = core->getProgram()->acceptedFileExtensions.begin(); i != core->getProgram()->acceptedFileExtensions.end(); ++i)
-		{
-			if (boost::algorithm::iends_with(file->name, *i))
-			{
-				result = true;
-				break;
-			}
-		}
-		if (!result)
-		{
-			core->getProgram()->logText(boost::str(boost::format("Transfer of file \"%1%\" rejected (invalid file type)") % commandTokens.at(3)));
-			sendAsync(boost::str(boost::format("%1%\t%2%\n") % Client::Transfer % Client::Error));
-			file.reset();
-			return;
-		}
-		for (std::set<std::string>::iterator i = core->getProgram()->illegalCharacters.begin(); i != core->getProgram()->illegalCharacters.begin(); ++i)
-		{
-			if (boost::algorithm::icontains(file->name, *i))
-			{
-				core->getProgram()->logText(boost::str(boost::format("Transfer of file \"%1%\" rejected (illegal characters)") % commandTokens.at(3)));
-				sendAsync(boost::str(boost::format("%1%\t%2%\n") % Client::Transfer % Client::Error));
-				file.reset();
-				return;
-			}
-		}
-		file->path = boost::str(boost::wformat(L"%1%\\%2%") % core->getProgram()->downloadPath % core->strtowstr(file->name));
-		if (!remote)
-		{
-			std::fstream fileHandle(file->path.c_str(), std::ios_base::in | std::ios_base::binary);
-			if (fileHandle)
-			{
-				if (transferable)
-				{
-					char fileBuffer[MAX_BUFFER];
-					boost::uint32_t fileChecksum = 0;
-					boost::crc_32_type fileDigest;
-					while (fileHandle)
-					{
-						fileHandle.read(fileBuffer, MAX_BUFFER);
-						fileDigest.process_bytes(fileBuffer, static_cast<std::size_t>(fileHandle.gcount()));
-					}
-					fileHandle.close();
-					fileChecksum = fileDigest.checksum();
-					if (!commandTokens.at(5).compare(boost::str(boost::format("%X") % fileChecksum)))
-					{
-						core->getProgram()->logText(boost::str(boost::format("Local file \"%1%\" passed CRC check") % commandTokens.at(3)));
-						sendAsync(boost::str(boost::format("%1%\t%2%\n") % Client::Transfer % Client::Check));
-						core->getAudio()->files.insert(std::make_pair(file->id, file->name));
-						file.reset();
-						return;
-					}
-				}
-				else
-				{
-					core->getProgram()->logText(boost::str(boost::format("Local file \"%1%\" exists") % commandTokens.at(3)));
-					sendAsync(boost::str(boost::format("%1%\t%2%\n") % Client::Transfer % Client::Check));
-					core->getAudio()->files.insert(std::make_pair(file->id, file->name));
-					file.reset();
-					return;
-				}
-			}
-			else
+			try
 			{
-				if (!transferable)
-				{
-					core->getProgram()->logText(boost::str(boost::format("Local file \"%1%\" does not exist") % commandTokens.at(3)));
-					sendAsync(boost::str(boost::format("%1%\t%2%\n") % Client::Transfer % Client::Error));
-					file.reset();
-					return;
-				}
+				file->essential = boost::lexical_cast<bool>(commandTokens.at(6));
 			}
-		}
-		if (!core->getProgram()->settings->transferFiles)
-		{
-			core->getProgram()->logText(boost::str(boost::format("Transfer of file \"%1%\" rejected (file transfer requests disabled)") % commandTokens.at(3)));
-			sendAsync(boost::str(boost::format("%1%\t%2%\n") % Client::Transfer % Client::Error));
-			file.reset();
-			return;
-		}
-		if (remote)
-		{
-			readStream.async_open(file->url, boost::bind(&Network::handleOpenStream, this, boost::asio::placeholders::error));
-		}
-		else
-		{
-			file->handle.open(file->path.c_str(), std::ios_base::out | std::ios_base::binary);
-			if (!file->handle)
+			catch (boost::bad_lexical_cast &)
 			{
-				core->getProgram()->logText(boost::str(boost::format("Error opening \"%1%\" for writing") % commandTokens.at(3)));
-				sendAsync(boost::str(boost::format("%1%\t%2%\n") % Client::Transfer % Client::Error));
-				file.reset();
+				core->getTransfer()->sendReply(file, Client::Error);
 				return;
 			}
-			core->getProgram()->logText(boost::str(boost::format("Transferring local file \"%1%\" (%2%)...") % file->name % outputFileSize(file->size)));
-			sendAsync(boost::str(boost::format("%1%\t%2%\n") % Client::Transfer % Client::Local));
-			clientSocket.async_read_some(boost::asio::buffer(file->buffer.c_array(), file->buffer.size()), boost::bind(&Network::handleReadFile, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
 		}
+		core->getTransfer()->addFile(file);
 	}
 	else if (commandTokens.size() == 1)
 	{
@@ -784,6 +806,87 @@ void Network::performTransfer()
 	}
 }
 
+void Network::performTransferData(const char *begin, const char *end)
+{
+	if (end - begin < 4)
+	{
+		return;
+	}
+	int fileID = 0;
+	decodeField(Token(begin, begin + 4), fileID);
+	if (!core->getTransfer()->localFile || core->getTransfer()->localFile->id != fileID)
+	{
+		return;
+	}
+	if (end - begin == 4)
+	{
+		core->getTransfer()->cancelLocalFile();
+		return;
+	}
+	core->getTransfer()->receiveLocalData(begin + 4, end - begin - 4);
+}
+
+void Network::finishManifest(const boost::shared_ptr<Manifest> &manifest)
+{
+	manifest->buffer.append("\n");
+	sendAsync(manifest->buffer);
+	core->getProgram()->logText(boost::str(boost::format("Verified manifest of %1% files (%2% missing)") % manifest->files % manifest->missingFiles));
+}
+
+bool Network::parseFile(const boost::shared_ptr<Transfer::File> &file, std::size_t index)
+{
+	try
+	{
+		file->transferable = boost::lexical_cast<bool>(commandTokens.at(index));
+		file->id = boost::lexical_cast<int>(commandTokens.at(index + 1));
+		file->size = boost::lexical_cast<std::size_t>(commandTokens.at(index + 3));
+	}
+	catch (boost::bad_lexical_cast &)
+	{
+		return false;
+	}
+	if (core->getProgram()->downloadPath.empty())
+	{
+		core->getProgram()->logText(boost::str(boost::format("Transfer of file \"%1%\" rejected (no download path specified)") % commandTokens.at(index + 2)));
+		return false;
+	}
+	file->checksum.assign(commandTokens.at(index + 4).begin(), commandTokens.at(index + 4).end());
+	if (boost::algorithm::istarts_with(commandTokens.at(index + 2), "http://"))
+	{
+		file->url.assign(commandTokens.at(index + 2).begin(), commandTokens.at(index + 2).end());
+		file->name = file->url.substr(file->url.find_last_of('/') + 1);
+	}
+	else
+	{
+		file->name.assign(commandTokens.at(index + 2).begin(), commandTokens.at(index + 2).end());
+	}
+	bool result = false;
+	for (std::set<std::string>::iterator i = core->getProgram()->acceptedFileExtensions.begin(); i != core->getProgram()->acceptedFileExtensions.end(); ++i)
+	{
+		if (boost::algorithm::iends_with(file->name, *i))
+		{
+			result = true;
+			break;
+		}
+	}
+	if (!result)
+	{
+		core->getProgram()->logText(boost::str(boost::format("Transfer of file \"%1%\" rejected (invalid file type)") % commandTokens.at(index + 2)));
+		return false;
+	}
+	for (std::set<std::string>::iterator i = core->getProgram()->illegalCharacters.begin(); i != core->getProgram()->illegalCharacters.begin(); ++i)
+	{
+		if (boost::algorithm::icontains(file->name, *i))
+		{
+			core->getProgram()->logText(boost::str(boost::format("Transfer of file \"%1%\" rejected (illegal characters)") % commandTokens.at(index + 2)));
+			return false;
+		}
+	}
+	file->path = boost::str(boost::wformat(L"%1%\\%2%") % core->getProgram()->downloadPath % core->strtowstr(file->name));
+	file->temporaryPath = boost::str(boost::wformat(L"%1%.part") % file->path);
+	return true;
+}
+
 void Network::performPlay()
 {
 	if (commandTokens.size() != 6)
@@ -804,7 +907,7 @@ void Network::performPlay()
 		return;
 	}
 	Audio::Stream stream;
-	stream.name = commandTokens.at(1);
+	stream.name.assign(commandTokens.at(1).begin(), commandTokens.at(1).end());
 	core->getAudio()->streams.insert(std::make_pair(handleID, stream));
 	core->getAudio()->playStream(handleID, pause, loop, downmix);
 }
@@ -816,7 +919,7 @@ void Network::performPlaySequence()
 		return;
 	}
 	std::map<int, Audio::Stream>::iterator s = core->getAudio()->streams.end();
-	std::vector<std::string> inputTokens;
+	std::vector<Token> inputTokens;
 	if (commandTokens.size() == 3)
 	{
 		int handleID = 0;
@@ -869,9 +972,9 @@ void Network::performPlaySequence()
 	{
 		return;
 	}
-	for (std::vector<std::string>::iterator i = inputTokens.begin(); i != inputTokens.end(); ++i)
+	for (std::vector<Token>::iterator i = inputTokens.begin(); i != inputTokens.end(); ++i)
 	{
-		if (!i->length())
+		if (i->empty())
 		{
 			continue;
 		}
@@ -907,7 +1010,7 @@ void Network::performPause()
 	int handleID = 0;
 	try
 	{
-		handleID = boost::lexical_cast<int>(commandTokens.at(1));
+		handleID = getArgument<int>(1);
 	}
 	catch (boost::bad_lexical_cast &)
 	{
@@ -932,7 +1035,7 @@ void Network::performResume()
 	int handleID = 0;
 	try
 	{
-		handleID = boost::lexical_cast<int>(commandTokens.at(1));
+		handleID = getArgument<int>(1);
 	}
 	catch (boost::bad_lexical_cast &)
 	{
@@ -957,15 +1060,20 @@ void Network::performStop()
 	int handleID = 0;
 	try
 	{
-		handleID = boost::lexical_cast<int>(commandTokens.at(1));
+		handleID = getArgument<int>(1);
 	}
 	catch (boost::bad_lexical_cast &)
 	{
 		return;
 	}
+	if (core->getAudio()->cancelPendingPlay(handleID))
+	{
+		return;
+	}
 	std::map<int, Audio::Stream>::iterator s = core->getAudio()->streams.find(handleID);
 	if (s != core->getAudio()->streams.end())
 	{
+		core->getAudio()->cancelRead(s->second);
 		BASS_ChannelStop(s->second.mixer);
 	}
 }
@@ -979,7 +1087,7 @@ void Network::performRestart()
 	int handleID = 0;
 	try
 	{
-		handleID = boost::lexical_cast<int>(commandTokens.at(1));
+		handleID = getArgument<int>(1);
 	}
 	catch (boost::bad_lexical_cast &)
 	{
@@ -1004,8 +1112,8 @@ void Network::performGetPosition()
 	int handleID = 0, requestID = 0;
 	try
 	{
-		requestID = boost::lexical_cast<int>(commandTokens.at(1));
-		handleID = boost::lexical_cast<int>(commandTokens.at(2));
+		requestID = getArgument<int>(1);
+		handleID = getArgument<int>(2);
 	}
 	catch (boost::bad_lexical_cast &)
 	{
@@ -1029,8 +1137,8 @@ void Network::performSetPosition()
 	int handleID = 0, seconds = 0;
 	try
 	{
-		handleID = boost::lexical_cast<int>(commandTokens.at(1));
-		seconds = boost::lexical_cast<int>(commandTokens.at(2));
+		handleID = getArgument<int>(1);
+		seconds = getArgument<int>(2);
 	}
 	catch (boost::bad_lexical_cast &)
 	{
@@ -1057,8 +1165,8 @@ void Network::performSetVolume()
 	float volume = 0.0f;
 	try
 	{
-		handleID = boost::lexical_cast<int>(commandTokens.at(1));
-		volume = boost::lexical_cast<float>(commandTokens.at(2));
+		handleID = getArgument<int>(1);
+		volume = getArgument<float>(2);
 	}
 	catch (boost::bad_lexical_cast &)
 	{
@@ -1087,8 +1195,8 @@ void Network::performSetFX()
 	int handleID = 0, type = 0;
 	try
 	{
-		handleID = boost::lexical_cast<int>(commandTokens.at(1));
-		type = boost::lexical_cast<int>(commandTokens.at(2));
+		handleID = getArgument<int>(1);
+		type = getArgument<int>(2);
 	}
 	catch (boost::bad_lexical_cast &)
 	{
@@ -1117,8 +1225,8 @@ void Network::performRemoveFX()
 	int handleID = 0, type = 0;
 	try
 	{
-		handleID = boost::lexical_cast<int>(commandTokens.at(1));
-		type = boost::lexical_cast<int>(commandTokens.at(2));
+		handleID = getArgument<int>(1);
+		type = getArgument<int>(2);
 	}
 	catch (boost::bad_lexical_cast &)
 	{
@@ -1145,7 +1253,7 @@ void Network::performSet3DPosition()
 	int handleID = 0;
 	try
 	{
-		handleID = boost::lexical_cast<int>(commandTokens.at(1));
+		handleID = getArgument<int>(1);
 	}
 	catch (boost::bad_lexical_cast &)
 	{
@@ -1157,10 +1265,10 @@ void Network::performSet3DPosition()
 		s->second.position = boost::shared_ptr<Audio::Stream::Position>(new Audio::Stream::Position);
 		try
 		{
-			s->second.position->vector.x = boost::lexical_cast<float>(commandTokens.at(2));
-			s->second.position->vector.y = boost::lexical_cast<float>(commandTokens.at(3));
-			s->second.position->vector.z = boost::lexical_cast<float>(commandTokens.at(4));
-			s->second.position->distance = boost::lexical_cast<float>(commandTokens.at(5));
+			s->second.position->vector.x = getArgument<float>(2);
+			s->second.position->vector.y = getArgument<float>(3);
+			s->second.position->vector.z = getArgument<float>(4);
+			s->second.position->distance = getArgument<float>(5);
 		}
 		catch (boost::bad_lexical_cast &)
 		{
@@ -1183,7 +1291,7 @@ void Network::performRemove3DPosition()
 	int handleID = 0;
 	try
 	{
-		handleID = boost::lexical_cast<int>(commandTokens.at(1));
+		handleID = getArgument<int>(1);
 	}
 	catch (boost::bad_lexical_cast &)
 	{
@@ -1209,7 +1317,7 @@ void Network::performSetRadioStation()
 	int radioStation = 0;
 	try
 	{
-		radioStation = boost::lexical_cast<int>(commandTokens.at(1));
+		radioStation = getArgument<int>(1);
 	}
 	catch (boost::bad_lexical_cast &)
 	{
@@ -18,15 +18,15 @@
 #define NETWORK_H
 
 #include "plugin.h"
+#include "transfer.h"
 
-#include <boost/array.hpp>
 #include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/range/iterator_range.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 
-#include <urdl/read_stream.hpp>
-
-#include <fstream>
 #include <string>
-#include <queue>
 #include <vector>
 
 class Network
@@ -40,21 +40,43 @@ public:
 
 	void closeConnection();
 
+	struct Statistics
+	{
+		Statistics();
+
+		std::size_t bytes;
+		unsigned int messages;
+		unsigned int writes;
+	};
+
+	boost::scoped_ptr<Statistics> statistics;
+
 	bool connected;
+	unsigned int features;
 private:
+	struct Manifest
+	{
+		Manifest();
+
+		std::string buffer;
+		std::size_t files;
+		std::size_t missingFiles;
+		std::size_t pendingFiles;
+	};
+
 	void handleConnect(const boost::system::error_code &error, boost::asio::ip::tcp::resolver::iterator endpoint_iterator);
 	void handleConnectTimer(const boost::system::error_code &error, boost::asio::ip::tcp::resolver::iterator endpoint_iterator);
 	void handleMainTimer(const boost::system::error_code &error);
-	void handleOpenStream(const boost::system::error_code &error);
+	void handleManifestFile(boost::shared_ptr<Manifest> manifest, boost::shared_ptr<Transfer::File> file, bool result);
 	void handleRead(const boost::system::error_code &error, std::size_t transferredBytes);
 	void handleResolve(const boost::system::error_code &error, boost::asio::ip::tcp::resolver::iterator endpoint_iterator);
-	void handleReadFile(const boost::system::error_code &error, std::size_t transferredBytes);
-	void handleReadStream(const boost::system::error_code &error, std::size_t transferredBytes);
 	void handleTimeoutTimer(const boost::system::error_code &error);
-	void handleWrite(const boost::system::error_code &error);
+	void handleWrite(const boost::system::error_code &error, std::size_t transferredBytes);
 
+	void readAsync();
 	void startAsync();
 	void stopAsync();
+	void writeAsync();
 
 	void startConnectTimer(boost::asio::ip::tcp::resolver::iterator endpoint_iterator);
 	void startTimeoutTimer();
@@ -62,13 +84,20 @@ private:
 	void stopMainTimer();
 	void stopTimeoutTimer();
 
-	void parseBuffer(const std::string &buffer);
-	std::string outputFileSize(std::size_t bytes);
+	void parseBuffer(const char *begin, const char *end);
+	void parseBinaryBuffer(const char *begin, const char *end);
+	void dispatchCommand(int command);
+	void processReceivedData();
 
 	void performConnect();
+	void performFeatures();
+	void performManifest();
 	void performMessage();
 	void performName();
 	void performTransfer();
+	void performTransferData(const char *begin, const char *end);
+	void finishManifest(const boost::shared_ptr<Manifest> &manifest);
+	bool parseFile(const boost::shared_ptr<Transfer::File> &file, std::size_t index);
 	void performPlay();
 	void performPlaySequence();
 	void performPause();
@@ -86,34 +115,31 @@ private:
 	void performSetRadioStation();
 	void performStopRadio();
 
-	struct File
-	{
-		boost::array<char, MAX_BUFFER> buffer;
-		std::fstream handle;
-		int id;
-		std::string name;
-		std::wstring path;
-		std::size_t size;
-		bool transferable;
-		std::string url;
-	};
+	typedef boost::iterator_range<const char*> Token;
 
-	boost::shared_ptr<File> file;
+	template<typename T> T getArgument(std::size_t index);
+
+	void decodeField(const Token &token, float &value);
+	void decodeField(const Token &token, int &value);
+	void decodeField(const Token &token, boost::uint32_t &value);
 
 	unsigned int attempts;
 	bool authenticated;
+	bool binaryMessage;
 	bool connecting;
 	boost::asio::ip::tcp::socket clientSocket;
 	boost::asio::deadline_timer connectTimer;
-	std::vector<std::string> commandTokens;
+	std::vector<Token> commandTokens;
 	DWORD lastCommunication;
 	boost::asio::deadline_timer mainTimer;
-	std::vector<std::string> messageTokens;
-	std::queue<std::string> pendingMessages;
-	char receivedData[MAX_BUFFER];
-	urdl::read_stream readStream;
+	std::size_t pendingCount;
+	std::vector<std::string> pendingMessages;
+	std::vector<char> receivedData;
+	std::size_t receivedBytes;
 	boost::asio::ip::tcp::resolver resolver;
-	std::string sentData;
+	std::vector<boost::asio::const_buffer> sentBuffers;
+	std::size_t sentCount;
+	std::vector<std::string> sentMessages;
 	boost::asio::deadline_timer timeoutTimer;
 	bool writeInProgress;
 };
@@ -129,7 +155,8 @@ namespace Client
 		Stop,
 		RadioStation,
 		Track,
-		Position
+		Position,
+		Manifest
 	};
 
 	enum PlayCodes
@@ -143,7 +170,8 @@ namespace Client
 		Local,
 		Remote,
 		Check,
-		Error
+		Error,
+		Delta
 	};
 };
 
@@ -170,7 +198,26 @@ namespace Server
 		Remove3DPosition,
 		GetRadioStation,
 		SetRadioStation,
-		StopRadio
+		StopRadio,
+		Features,
+		TransferData,
+		Manifest
+	};
+};
+
+namespace Features
+{
+	enum Flags
+	{
+		Binary = 1 << 0,
+		Multiplexed = 1 << 1,
+		Concurrent = 1 << 2,
+		Resume = 1 << 3,
+		Manifest = 1 << 4,
+		Compressed = 1 << 5,
+		Delta = 1 << 6,
+		Prefetch = 1 << 7,
+		Supported = Binary | Multiplexed | Concurrent | Resume | Manifest | Compressed | Delta | Prefetch
 	};
 };
 
@@ -20,8 +20,20 @@
 #define PLUGIN_VERSION "0.5"
 
 #define MAX_BUFFER (512)
+#define MAX_MESSAGE (1048576)
+
+#define CHECKSUM_BUFFER (65536)
+#define DELTA_BLOCK (16384)
+#define MAX_DELTA_BLOCKS (4096)
+#define PROGRESSIVE_BUFFER (65536)
+#define WRITE_BUFFER (262144)
+
+#define BINARY_FRAME_FLAG (0x80)
+#define BINARY_HEADER_SIZE (3)
 
 #define GAME_TIMER_TICK (50)
+#define JOURNAL_INTERVAL (1000)
 #define NETWORK_TIMER_TICK (1000)
+#define PROGRESSIVE_TIMEOUT (30000)
 
 #endif
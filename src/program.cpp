@@ -22,6 +22,7 @@
 #include <BASS/basswma.h>
 
 #include <boost/algorithm/string.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
 #include <boost/lexical_cast.hpp>
@@ -68,6 +69,7 @@ Program::Program()
 		".mtm",
 		".oga",
 		".ogg",
+		".pak",
 		".s3m",
 		".umx",
 		".wav",
@@ -103,13 +105,21 @@ Program::Program()
 Program::Settings::Settings()
 {
 	allowRadioStationAdjustment = true;
+	concurrentTransfers = 4;
 	connectAttempts = 10;
 	connectDelay = 10000;
 	connectTimeout = 5000;
 	enableLogging = true;
+	gameTransferRate = 0;
 	networkTimeout = 20000;
+	packQuota = 2147483648;
+	prefetchTransferRate = 65536;
+	segmentThreshold = 8388608;
 	streamFiles = true;
 	transferFiles = true;
+	transferRate = 0;
+	transferSegments = 4;
+	verificationThreads = 2;
 }
 
 void Program::createLogFile()
@@ -191,7 +201,7 @@ void Program::loadSettings()
 	if (!error)
 	{
 		bool modified = false;
-		const wchar_t *value[8];
+		const wchar_t *value[16];
 		value[0] = ini.GetValue(L"settings", L"allow_radio_station_adjustment");
 		value[1] = ini.GetValue(L"settings", L"connect_attempts");
 		value[2] = ini.GetValue(L"settings", L"connect_delay");
@@ -200,6 +210,14 @@ void Program::loadSettings()
 		value[5] = ini.GetValue(L"settings", L"network_timeout");
 		value[6] = ini.GetValue(L"settings", L"stream_files_from_internet");
 		value[7] = ini.GetValue(L"settings", L"transfer_files_from_server");
+		value[8] = ini.GetValue(L"settings", L"concurrent_transfers");
+		value[9] = ini.GetValue(L"settings", L"verification_threads");
+		value[10] = ini.GetValue(L"settings", L"segment_threshold");
+		value[11] = ini.GetValue(L"settings", L"transfer_segments");
+		value[12] = ini.GetValue(L"settings", L"transfer_rate");
+		value[13] = ini.GetValue(L"settings", L"game_transfer_rate");
+		value[14] = ini.GetValue(L"settings", L"audio_pack_quota");
+		value[15] = ini.GetValue(L"settings", L"prefetch_transfer_rate");
 		if (value[0])
 		{
 			try
@@ -308,6 +326,126 @@ void Program::loadSettings()
 			ini.SetValue(L"settings", L"transfer_files_from_server", boost::lexical_cast<std::wstring>(settings->transferFiles).c_str());
 			modified = true;
 		}
+		if (value[8])
+		{
+			try
+			{
+				settings->concurrentTransfers = boost::lexical_cast<unsigned int>(value[8]);
+			}
+			catch (boost::bad_lexical_cast &) {}
+			if (settings->concurrentTransfers < 1)
+			{
+				settings->concurrentTransfers = 1;
+			}
+		}
+		else
+		{
+			ini.SetValue(L"settings", L"concurrent_transfers", boost::lexical_cast<std::wstring>(settings->concurrentTransfers).c_str());
+			modified = true;
+		}
+		if (value[9])
+		{
+			try
+			{
+				settings->verificationThreads = boost::lexical_cast<unsigned int>(value[9]);
+			}
+			catch (boost::bad_lexical_cast &) {}
+			if (settings->verificationThreads < 1)
+			{
+				settings->verificationThreads = 1;
+			}
+		}
+		else
+		{
+			ini.SetValue(L"settings", L"verification_threads", boost::lexical_cast<std::wstring>(settings->verificationThreads).c_str());
+			modified = true;
+		}
+		if (value[10])
+		{
+			try
+			{
+				settings->segmentThreshold = boost::lexical_cast<std::size_t>(value[10]) * 1048576;
+			}
+			catch (boost::bad_lexical_cast &) {}
+			if (settings->segmentThreshold < 1048576)
+			{
+				settings->segmentThreshold = 1048576;
+			}
+		}
+		else
+		{
+			ini.SetValue(L"settings", L"segment_threshold", boost::lexical_cast<std::wstring>(settings->segmentThreshold / 1048576).c_str());
+			modified = true;
+		}
+		if (value[11])
+		{
+			try
+			{
+				settings->transferSegments = boost::lexical_cast<unsigned int>(value[11]);
+			}
+			catch (boost::bad_lexical_cast &) {}
+			if (settings->transferSegments < 1)
+			{
+				settings->transferSegments = 1;
+			}
+		}
+		else
+		{
+			ini.SetValue(L"settings", L"transfer_segments", boost::lexical_cast<std::wstring>(settings->transferSegments).c_str());
+			modified = true;
+		}
+		if (value[12])
+		{
+			try
+			{
+				settings->transferRate = boost::lexical_cast<std::size_t>(value[12]) * 1024;
+			}
+			catch (boost::bad_lexical_cast &) {}
+		}
+		else
+		{
+			ini.SetValue(L"settings", L"transfer_rate", boost::lexical_cast<std::wstring>(settings->transferRate / 1024).c_str());
+			modified = true;
+		}
+		if (value[13])
+		{
+			try
+			{
+				settings->gameTransferRate = boost::lexical_cast<std::size_t>(value[13]) * 1024;
+			}
+			catch (boost::bad_lexical_cast &) {}
+		}
+		else
+		{
+			ini.SetValue(L"settings", L"game_transfer_rate", boost::lexical_cast<std::wstring>(settings->gameTransferRate / 1024).c_str());
+			modified = true;
+		}
+		if (value[14])
+		{
+			try
+			{
+				settings->packQuota = boost::lexical_cast<boost::uintmax_t>(value[14]) * 1048576;
+			}
+			catch (boost::bad_lexical_cast &) {}
+		}
+		else
+		{
+			ini.SetValue(L"settings", L"audio_pack_quota", boost::lexical_cast<std::wstring>(settings->packQuota / 1048576).c_str());
+			modified = true;
+		}
+		if (value[15])
+		{
+			try
+			{
+				settings->prefetchTransferRate = boost::lexical_cast<std::size_t>(value[15]) * 1024;
+			}
+			catch (boost::bad_lexical_cast &) {}
+		}
+		else
+		{
+			ini.SetValue(L"settings", L"prefetch_transfer_rate", boost::lexical_cast<std::wstring>(settings->prefetchTransferRate / 1024).c_str());
+			modified = true;
+		}
 		if (modified)
 		{
 			ini.SaveFile(filePath.c_str());
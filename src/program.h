@@ -17,8 +17,10 @@
 #ifndef PROGRAM_H
 #define PROGRAM_H
 
+#include <boost/cstdint.hpp>
 #include <boost/scoped_ptr.hpp>
 
+#include <cstddef>
 #include <set>
 #include <string>
 
@@ -36,13 +38,21 @@ public:
 		Settings();
 
 		bool allowRadioStationAdjustment;
+		unsigned int concurrentTransfers;
 		unsigned int connectAttempts;
 		unsigned int connectDelay;
 		unsigned int connectTimeout;
 		bool enableLogging;
+		std::size_t gameTransferRate;
 		unsigned int networkTimeout;
+		boost::uintmax_t packQuota;
+		std::size_t prefetchTransferRate;
+		std::size_t segmentThreshold;
 		bool streamFiles;
 		bool transferFiles;
+		std::size_t transferRate;
+		unsigned int transferSegments;
+		unsigned int verificationThreads;
 	};
 
 	boost::scoped_ptr<Settings> settings;
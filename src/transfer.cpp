@@ -0,0 +1,2080 @@
+/*
+ * Copyright (C) 2012 Incognito
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "transfer.h"
+
+#include "archive.h"
+#include "core.h"
+#include "digest.h"
+#include "inflater.h"
+#include "plugin.h"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/function.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <SimpleIni/SimpleIni.h>
+
+#include <urdl/http.hpp>
+#include <urdl/read_stream.hpp>
+#include <urdl/url.hpp>
+
+#include <algorithm>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace
+{
+	struct AllocationInformation
+	{
+		LARGE_INTEGER allocationSize;
+	};
+
+	typedef BOOL (WINAPI *SetFileInformationByHandleFunction)(HANDLE file, int informationClass, LPVOID information, DWORD size);
+
+	const int FileAllocationInformationClass = 5;
+
+	boost::uint32_t calculateRollingChecksum(const unsigned char *data, std::size_t size)
+	{
+		boost::uint32_t a = 0, b = 0;
+		for (std::size_t i = 0; i < size; ++i)
+		{
+			a += data[i];
+			b += static_cast<boost::uint32_t>(size - i) * data[i];
+		}
+		return (a & 0xFFFF) | (b << 16);
+	}
+
+	boost::uint32_t decodeInteger(const char *data)
+	{
+		const unsigned char *bytes = reinterpret_cast<const unsigned char*>(data);
+		return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<boost::uint32_t>(bytes[3]) << 24);
+	}
+}
+
+Transfer::Transfer(boost::asio::io_service &io_service) : io_service(io_service), throttleTimer(io_service)
+{
+	prefetching = false;
+	throttledPrefetch = false;
+	tokens = 0;
+	writeWork.reset(new boost::asio::io_service::work(writeService));
+	writer = boost::thread(boost::bind(&Transfer::runWriter, this));
+}
+
+Transfer::~Transfer()
+{
+	work.reset();
+	workService.stop();
+	workers.join_all();
+	writeWork.reset();
+	writer.join();
+}
+
+Transfer::Buffer::Buffer()
+{
+	closed = false;
+	data.resize(WRITE_BUFFER + MAX_BUFFER);
+	dataBytes = 0;
+	flushing = false;
+	offset = 0;
+	progressive = false;
+	spare.resize(WRITE_BUFFER + MAX_BUFFER);
+	spareBytes = 0;
+	spareOffset = 0;
+}
+
+Transfer::Delta::Delta()
+{
+	blockSize = DELTA_BLOCK;
+	literalBytes = 0;
+	sourceSize = 0;
+}
+
+Transfer::Progress::Progress()
+{
+	availableBytes = 0;
+	complete = false;
+	finished = false;
+	size = 0;
+}
+
+Transfer::Segment::Segment()
+{
+	offset = 0;
+	remainingBytes = 0;
+}
+
+Transfer::File::File()
+{
+	completedSegments = 0;
+	essential = true;
+	id = 0;
+	offset = 0;
+	reservation = INVALID_HANDLE_VALUE;
+	reused = false;
+	size = 0;
+	transferable = false;
+}
+
+Transfer::Checksum::Checksum()
+{
+	size = 0;
+	time = 0;
+}
+
+Transfer::PartialFile::PartialFile()
+{
+	bytes = 0;
+	size = 0;
+}
+
+void Transfer::handleCheckFile(boost::shared_ptr<File> file, bool result)
+{
+	if (result)
+	{
+		sendReply(file, Client::Check);
+		return;
+	}
+	if (!file->transferable)
+	{
+		core->getProgram()->logText(boost::str(boost::format("Local file \"%1%\" does not exist") % file->name));
+		sendReply(file, Client::Error);
+		return;
+	}
+	queueFile(file);
+}
+
+void Transfer::handleArchiveChecksum(boost::shared_ptr<Archive> packArchive, boost::shared_ptr<File> file, std::string checksum, CheckHandler handler)
+{
+	if (!checkingFiles.erase(file))
+	{
+		return;
+	}
+	if (archive == packArchive)
+	{
+		const Archive::Entry *entry = archive->findEntry(file->name);
+		if (entry && !entry->checksum.compare(checksum))
+		{
+			archive->verifyEntry(file->name);
+		}
+		else
+		{
+			core->getProgram()->logText(boost::str(boost::format("Local file \"%1%\" failed CRC check in pack archive") % file->name));
+			archive->removeEntry(file->name);
+		}
+	}
+	checkFile(file, handler);
+}
+
+void Transfer::handleChecksum(boost::shared_ptr<File> file, Checksum checksum, CheckHandler handler)
+{
+	if (!checkingFiles.erase(file))
+	{
+		return;
+	}
+	checksums[file->name] = checksum;
+	if (checkingFiles.empty())
+	{
+		saveChecksums();
+	}
+	finishCheckFile(file, checksum.value, handler);
+}
+
+void Transfer::handleCopyCachedFile(boost::shared_ptr<File> file, bool result, CheckHandler handler)
+{
+	if (!checkingFiles.erase(file))
+	{
+		return;
+	}
+	if (!result || !recordCachedFile(file))
+	{
+		handler(false);
+		return;
+	}
+	checkFile(file, handler);
+}
+
+void Transfer::handleOpenSegment(boost::shared_ptr<File> file, boost::shared_ptr<Segment> segment, const boost::system::error_code &error)
+{
+	if (remoteFiles.find(file) == remoteFiles.end() || std::find(file->segments.begin(), file->segments.end(), segment) == file->segments.end())
+	{
+		return;
+	}
+	if (error)
+	{
+		core->getProgram()->logText(boost::str(boost::format("Error opening segment at %1% for remote file \"%2%\": %3%") % segment->offset % file->url % error.message()));
+		sendReply(file, Client::Error);
+		finishRemoteFile(file);
+		return;
+	}
+	if (!boost::algorithm::icontains(segment->stream->headers(), "Content-Range:"))
+	{
+		abandonSegments(file, segment);
+		return;
+	}
+	if (segment->stream->content_length() != segment->remainingBytes)
+	{
+		core->getProgram()->logText(boost::str(boost::format("Error opening segment at %1% for remote file \"%2%\": Range not satisfied") % segment->offset % file->url));
+		sendReply(file, Client::Error);
+		finishRemoteFile(file);
+		return;
+	}
+	readSegment(file, segment);
+}
+
+void Transfer::handleOpenStream(boost::shared_ptr<File> file, const boost::system::error_code &error)
+{
+	if (remoteFiles.find(file) == remoteFiles.end())
+	{
+		return;
+	}
+	if (error == urdl::http::errc::not_modified)
+	{
+		core->getProgram()->logText(boost::str(boost::format("Remote file \"%1%\" passed revalidation") % file->url));
+		sendReply(file, Client::Check);
+		core->getAudio()->files.insert(std::make_pair(file->id, file->name));
+		finishRemoteFile(file);
+		return;
+	}
+	if (error && file->reused && error.category() != urdl::http::error_category())
+	{
+		boost::system::error_code closeError;
+		file->stream->close(closeError);
+		startRemoteFile(file);
+		return;
+	}
+	if (error)
+	{
+		core->getProgram()->logText(boost::str(boost::format("Error opening stream for remote file \"%1%\": %2%") % file->url % error.message()));
+		sendReply(file, Client::Error);
+		finishRemoteFile(file);
+		return;
+	}
+	file->headers = file->stream->headers();
+	if (file->offset && boost::algorithm::icontains(file->headers, "Content-Range:"))
+	{
+		file->size = file->offset + file->stream->content_length();
+		file->handle.open(file->temporaryPath.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+	}
+	else
+	{
+		std::string encoding = getHeader(file->stream->headers(), "Content-Encoding");
+		if (boost::algorithm::iequals(encoding, "gzip") || boost::algorithm::iequals(encoding, "x-gzip"))
+		{
+			file->inflater.reset(new Inflater(Inflater::Gzip));
+		}
+		else if (boost::algorithm::iequals(encoding, "deflate"))
+		{
+			file->inflater.reset(new Inflater(Inflater::Deflate));
+		}
+		file->size = file->stream->content_length();
+		if (!file->inflater && !file->offset && getValidators(file).empty())
+		{
+			std::fstream fileHandle(file->path.c_str(), std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
+			if (fileHandle)
+			{
+				if (file->size == fileHandle.tellg())
+				{
+					core->getProgram()->logText(boost::str(boost::format("Remote file \"%1%\" passed file size check") % file->url));
+					sendReply(file, Client::Check);
+					core->getAudio()->files.insert(std::make_pair(file->id, file->name));
+					finishRemoteFile(file);
+					return;
+				}
+				fileHandle.close();
+			}
+		}
+		file->offset = 0;
+		file->handle.open(file->temporaryPath.c_str(), std::ios_base::out | std::ios_base::binary);
+	}
+	if (!file->handle)
+	{
+		core->getProgram()->logText(boost::str(boost::format("Error opening \"%1%\" for writing") % file->name));
+		sendReply(file, Client::Error);
+		finishRemoteFile(file);
+		return;
+	}
+	file->progress.reset(new Progress);
+	file->progress->availableBytes = file->offset;
+	file->handle.rdbuf()->pubsetbuf(NULL, 0);
+	file->writeBuffer.reset(new Buffer);
+	file->writeBuffer->offset = file->offset;
+	file->writeBuffer->progressive = true;
+	if (!file->inflater)
+	{
+		file->progress->size = file->size;
+		writeService.post(boost::bind(&Transfer::allocateFile, this, file));
+	}
+	if (!file->inflater && !file->offset && core->getProgram()->settings->transferSegments > 1 && file->size >= core->getProgram()->settings->segmentThreshold && boost::algorithm::iequals(getHeader(file->stream->headers(), "Accept-Ranges"), "bytes") && !getRangeValidator(file).empty())
+	{
+		startSegments(file);
+		return;
+	}
+	if (file->inflater)
+	{
+		core->getProgram()->logText(boost::str(boost::format("Transferring remote file \"%1%\" (%2% compressed)...") % file->url % core->outputFileSize(file->size)));
+	}
+	else if (file->offset)
+	{
+		savePartialFile(file);
+		core->getProgram()->logText(boost::str(boost::format("Resuming remote file \"%1%\" at %2% of %3%...") % file->url % core->outputFileSize(file->offset) % core->outputFileSize(file->size)));
+	}
+	else
+	{
+		savePartialFile(file);
+		core->getProgram()->logText(boost::str(boost::format("Transferring remote file \"%1%\" (%2%)...") % file->url % core->outputFileSize(file->size)));
+	}
+	readStream(file);
+}
+
+void Transfer::handleReadSegment(boost::shared_ptr<File> file, boost::shared_ptr<Segment> segment, const boost::system::error_code &error, std::size_t transferredBytes)
+{
+	if (remoteFiles.find(file) == remoteFiles.end() || std::find(file->segments.begin(), file->segments.end(), segment) == file->segments.end())
+	{
+		return;
+	}
+	segment->offset += transferredBytes;
+	segment->remainingBytes -= transferredBytes;
+	segment->writeBuffer->dataBytes += transferredBytes;
+	if (!segment->remainingBytes)
+	{
+		if (++file->completedSegments == file->segments.size())
+		{
+			closeFile(file, boost::bind(&Transfer::completeRemoteFile, this, file, _1));
+			releaseRemoteFile(file);
+		}
+		return;
+	}
+	if (error || !transferredBytes)
+	{
+		core->getProgram()->logText(boost::str(boost::format("Error reading segment at %1% for remote file \"%2%\" during transfer: %3%") % segment->offset % file->url % (error ? error.message() : "No data received")));
+		sendReply(file, Client::Error);
+		finishRemoteFile(file);
+		return;
+	}
+	ThrottleHandler handler = boost::bind(&Transfer::readSegment, this, file, segment);
+	commitBuffer(file, segment->writeBuffer, boost::bind(&Transfer::throttle, this, file, transferredBytes, handler));
+}
+
+void Transfer::handleReadStream(boost::shared_ptr<File> file, const boost::system::error_code &error, std::size_t transferredBytes)
+{
+	if (remoteFiles.find(file) == remoteFiles.end())
+	{
+		return;
+	}
+	if (!error)
+	{
+		if (transferredBytes)
+		{
+			ThrottleHandler handler = boost::bind(&Transfer::readStream, this, file);
+			if (file->inflater)
+			{
+				file->inflater->process(file->buffer.c_array(), transferredBytes, file->output);
+				if (file->inflater->failed())
+				{
+					core->getProgram()->logText(boost::str(boost::format("Error decompressing data for remote file \"%1%\" during transfer") % file->url));
+					sendReply(file, Client::Error);
+					finishRemoteFile(file);
+					return;
+				}
+				writeFile(file, file->writeBuffer, file->output.empty() ? NULL : &file->output[0], file->output.size(), boost::bind(&Transfer::throttle, this, file, transferredBytes, handler));
+				file->output.clear();
+			}
+			else
+			{
+				file->writeBuffer->dataBytes += transferredBytes;
+				commitBuffer(file, file->writeBuffer, boost::bind(&Transfer::throttle, this, file, transferredBytes, handler));
+			}
+			return;
+		}
+		core->getProgram()->logText(boost::str(boost::format("Error reading stream for remote file \"%1%\" during transfer: No data received") % file->url));
+		sendReply(file, Client::Error);
+	}
+	else
+	{
+		if (error != boost::asio::error::eof)
+		{
+			core->getProgram()->logText(boost::str(boost::format("Error reading stream for remote file \"%1%\" during transfer: %2%") % file->url % error.message()));
+			sendReply(file, Client::Error);
+		}
+		else if (file->inflater && !file->inflater->finished())
+		{
+			core->getProgram()->logText(boost::str(boost::format("Error reading stream for remote file \"%1%\" during transfer: Incomplete compressed data") % file->url));
+			sendReply(file, Client::Error);
+		}
+		else
+		{
+			closeFile(file, boost::bind(&Transfer::completeRemoteFile, this, file, _1));
+			releaseRemoteFile(file);
+			return;
+		}
+	}
+	finishRemoteFile(file);
+}
+
+void Transfer::handleSignatures(boost::shared_ptr<File> file, std::size_t blockSize, std::string signatures)
+{
+	if (signingFile != file)
+	{
+		return;
+	}
+	localFile = signingFile;
+	signingFile.reset();
+	localFile->delta->blockSize = blockSize;
+	localFile->delta->signatures.swap(signatures);
+	core->getProgram()->logText(boost::str(boost::format("Transferring local file \"%1%\" (%2%) as a block delta against %3% on disk...") % localFile->name % core->outputFileSize(localFile->size) % core->outputFileSize(localFile->delta->sourceSize)));
+	sendReply(localFile, Client::Delta);
+	localFile->delta->signatures.clear();
+}
+
+void Transfer::handleThrottleTimer(const boost::system::error_code &error)
+{
+	if (error)
+	{
+		return;
+	}
+	std::size_t rate = refillTokens(throttledPrefetch);
+	if (rate && tokens < 0)
+	{
+		startThrottleTimer(rate);
+		return;
+	}
+	std::deque<ThrottleHandler> handlers;
+	handlers.swap(throttledHandlers);
+	for (std::deque<ThrottleHandler>::iterator h = handlers.begin(); h != handlers.end(); ++h)
+	{
+		(*h)();
+	}
+}
+
+void Transfer::handleVerifyFile(boost::shared_ptr<File> file, bool result)
+{
+	if (result)
+	{
+		return;
+	}
+	core->getProgram()->logText(boost::str(boost::format("Local file \"%1%\" failed CRC check after transfer") % file->name));
+	std::map<int, std::string>::iterator f = core->getAudio()->files.find(file->id);
+	if (f != core->getAudio()->files.end() && f->second == file->name)
+	{
+		core->getAudio()->files.erase(f);
+	}
+	if (boost::algorithm::iequals(file->name, "audio.pak"))
+	{
+		archive.reset();
+	}
+	if (checksums.erase(file->name))
+	{
+		saveChecksums();
+	}
+	boost::system::error_code error;
+	std::wstring cachePath = getCachePath(file);
+	if (!cachePath.empty() && boost::filesystem::equivalent(cachePath, file->path, error))
+	{
+		boost::filesystem::remove(cachePath, error);
+	}
+	boost::filesystem::remove(file->path, error);
+	sendReply(file, Client::Error);
+}
+
+void Transfer::handleWriteBuffer(boost::shared_ptr<File> file, boost::shared_ptr<Buffer> buffer, bool result)
+{
+	std::size_t flushedBytes = buffer->spareOffset + buffer->spareBytes;
+	buffer->flushing = false;
+	buffer->spareBytes = 0;
+	ThrottleHandler handler;
+	handler.swap(buffer->handler);
+	if (!result)
+	{
+		if (remoteFiles.find(file) != remoteFiles.end())
+		{
+			core->getProgram()->logText(boost::str(boost::format("Error writing data for remote file \"%1%\" during transfer") % file->url));
+			sendReply(file, Client::Error);
+			finishRemoteFile(file);
+		}
+		else if (file == localFile)
+		{
+			core->getProgram()->logText(boost::str(boost::format("Error writing data for local file \"%1%\" during transfer") % localFile->name));
+			sendReply(localFile, Client::Error);
+			closeFile(localFile, boost::bind(&Transfer::discardFile, this, localFile));
+			localFile.reset();
+			startQueuedFiles();
+		}
+	}
+	else
+	{
+		if (buffer == file->writeBuffer)
+		{
+			updatePartialFile(file, flushedBytes);
+		}
+		if (!buffer->closed && buffer->dataBytes >= WRITE_BUFFER)
+		{
+			flushBuffer(file, buffer);
+		}
+	}
+	if (handler)
+	{
+		handler();
+	}
+}
+
+void Transfer::addFile(const boost::shared_ptr<File> &file)
+{
+	if (file->url.empty() && !isPartialFile(file))
+	{
+		checkFile(file, boost::bind(&Transfer::handleCheckFile, this, file, _1));
+		return;
+	}
+	queueFile(file);
+}
+
+void Transfer::queueFile(const boost::shared_ptr<File> &file)
+{
+	if (!core->getProgram()->settings->transferFiles)
+	{
+		core->getProgram()->logText(boost::str(boost::format("Transfer of file \"%1%\" rejected (file transfer requests disabled)") % (file->url.empty() ? file->name : file->url)));
+		sendReply(file, Client::Error);
+		return;
+	}
+	if (archive)
+	{
+		if (boost::algorithm::iequals(file->name, "audio.pak"))
+		{
+			archive.reset();
+		}
+		else
+		{
+			archive->removeEntry(file->name);
+		}
+	}
+	std::deque<boost::shared_ptr<File> >::iterator f = queuedFiles.end();
+	if (file->essential)
+	{
+		f = queuedFiles.begin();
+		while (f != queuedFiles.end() && (*f)->essential)
+		{
+			++f;
+		}
+	}
+	queuedFiles.insert(f, file);
+	startQueuedFiles();
+}
+
+void Transfer::cancelLocalFile()
+{
+	core->getProgram()->logText(boost::str(boost::format("Transfer of local file \"%1%\" canceled server-side") % localFile->name));
+	closeFile(localFile, boost::bind(&Transfer::discardFile, this, localFile));
+	localFile.reset();
+	startQueuedFiles();
+}
+
+void Transfer::checkFile(const boost::shared_ptr<File> &file, const CheckHandler &handler)
+{
+	if (archive)
+	{
+		const Archive::Entry *entry = archive->findEntry(file->name);
+		if (entry && (!file->transferable || (entry->length == file->size && !file->checksum.compare(entry->checksum))))
+		{
+			if (!entry->verified)
+			{
+				startWorkers();
+				checkingFiles.insert(file);
+				workService.post(boost::bind(&Transfer::calculateArchiveChecksum, this, archive, file, *entry, handler));
+				return;
+			}
+			core->getProgram()->logText(boost::str(boost::format("Local file \"%1%\" found in pack archive") % file->name));
+			core->getAudio()->files.insert(std::make_pair(file->id, file->name));
+			handler(true);
+			return;
+		}
+		archive->removeEntry(file->name);
+	}
+	boost::system::error_code error;
+	if (file->transferable && !boost::filesystem::exists(file->path, error) && linkCachedFile(file, handler))
+	{
+		return;
+	}
+	Checksum checksum;
+	checksum.size = static_cast<std::size_t>(boost::filesystem::file_size(file->path, error));
+	if (!error)
+	{
+		checksum.time = boost::filesystem::last_write_time(file->path, error);
+	}
+	if (error)
+	{
+		handler(false);
+		return;
+	}
+	if (!file->transferable)
+	{
+		core->getProgram()->logText(boost::str(boost::format("Local file \"%1%\" exists") % file->name));
+		core->getAudio()->files.insert(std::make_pair(file->id, file->name));
+		handler(true);
+		return;
+	}
+	std::map<std::string, Checksum>::iterator c = checksums.find(file->name);
+	if (c != checksums.end() && c->second.size == checksum.size && c->second.time == checksum.time && !c->second.value.empty())
+	{
+		finishCheckFile(file, c->second.value, handler);
+		return;
+	}
+	startWorkers();
+	checkingFiles.insert(file);
+	workService.post(boost::bind(&Transfer::calculateChecksum, this, file, checksum, handler));
+}
+
+boost::shared_ptr<Transfer::File> Transfer::findFile(int id)
+{
+	if (localFile && localFile->id == id && localFile->progress)
+	{
+		return localFile;
+	}
+	for (std::set<boost::shared_ptr<File> >::iterator f = remoteFiles.begin(); f != remoteFiles.end(); ++f)
+	{
+		if ((*f)->id == id && (*f)->progress)
+		{
+			return *f;
+		}
+	}
+	return boost::shared_ptr<File>();
+}
+
+void Transfer::loadArchive()
+{
+	archive.reset();
+	std::wstring filePath = boost::str(boost::wformat(L"%1%\\audio.pak") % core->getProgram()->downloadPath);
+	if (!boost::filesystem::exists(filePath))
+	{
+		return;
+	}
+	boost::shared_ptr<Archive> packArchive(new Archive);
+	if (!packArchive->open(filePath))
+	{
+		core->getProgram()->logText("Error opening pack archive \"audio.pak\": Invalid or unreadable archive");
+		return;
+	}
+	core->getProgram()->logText(boost::str(boost::format("Pack archive \"audio.pak\" opened (%1% files)") % packArchive->size()));
+	archive = packArchive;
+}
+
+void Transfer::loadChecksums()
+{
+	checksums.clear();
+	std::wstring filePath = boost::str(boost::wformat(L"%1%\\checksums.ini") % core->getProgram()->downloadPath);
+	CSimpleIniW ini(true, false, true);
+	if (ini.LoadFile(filePath.c_str()) < 0)
+	{
+		return;
+	}
+	CSimpleIniW::TNamesDepend sections;
+	ini.GetAllSections(sections);
+	for (CSimpleIniW::TNamesDepend::iterator s = sections.begin(); s != sections.end(); ++s)
+	{
+		const wchar_t *value[3];
+		value[0] = ini.GetValue(s->pItem, L"size");
+		value[1] = ini.GetValue(s->pItem, L"time");
+		value[2] = ini.GetValue(s->pItem, L"crc");
+		if (!value[0] || !value[1] || !value[2])
+		{
+			continue;
+		}
+		Checksum checksum;
+		try
+		{
+			checksum.size = boost::lexical_cast<std::size_t>(value[0]);
+			checksum.time = boost::lexical_cast<std::time_t>(value[1]);
+		}
+		catch (boost::bad_lexical_cast &)
+		{
+			continue;
+		}
+		checksum.value = core->wstrtostr(value[2]);
+		const wchar_t *validator = ini.GetValue(s->pItem, L"etag");
+		if (validator)
+		{
+			checksum.entityTag = core->wstrtostr(validator);
+		}
+		validator = ini.GetValue(s->pItem, L"modified");
+		if (validator)
+		{
+			checksum.lastModified = core->wstrtostr(validator);
+		}
+		checksums.insert(std::make_pair(core->wstrtostr(s->pItem), checksum));
+	}
+}
+
+void Transfer::loadJournal()
+{
+	partialFiles.clear();
+	journalPath = boost::str(boost::wformat(L"%1%\\transfers.ini") % core->getProgram()->downloadPath);
+	CSimpleIniW ini(true, false, true);
+	if (ini.LoadFile(journalPath.c_str()) < 0)
+	{
+		return;
+	}
+	CSimpleIniW::TNamesDepend sections;
+	ini.GetAllSections(sections);
+	for (CSimpleIniW::TNamesDepend::iterator s = sections.begin(); s != sections.end(); ++s)
+	{
+		const wchar_t *value[4];
+		value[0] = ini.GetValue(s->pItem, L"bytes");
+		value[1] = ini.GetValue(s->pItem, L"checksum");
+		value[2] = ini.GetValue(s->pItem, L"size");
+		value[3] = ini.GetValue(s->pItem, L"url");
+		if (!value[0] || !value[1] || !value[2] || !value[3])
+		{
+			continue;
+		}
+		PartialFile partialFile;
+		try
+		{
+			partialFile.bytes = boost::lexical_cast<std::size_t>(value[0]);
+			partialFile.size = boost::lexical_cast<std::size_t>(value[2]);
+		}
+		catch (boost::bad_lexical_cast &)
+		{
+			continue;
+		}
+		partialFile.checksum = core->wstrtostr(value[1]);
+		partialFile.url = core->wstrtostr(value[3]);
+		partialFiles.insert(std::make_pair(core->wstrtostr(s->pItem), partialFile));
+	}
+	std::size_t journalSize = partialFiles.size();
+	for (std::map<std::string, PartialFile>::iterator p = partialFiles.begin(); p != partialFiles.end(); )
+	{
+		boost::system::error_code error;
+		if (!boost::filesystem::exists(boost::str(boost::wformat(L"%1%\\%2%.part") % core->getProgram()->downloadPath % core->strtowstr(p->first)), error))
+		{
+			partialFiles.erase(p++);
+		}
+		else
+		{
+			++p;
+		}
+	}
+	boost::system::error_code error;
+	for (boost::filesystem::directory_iterator d(core->getProgram()->downloadPath, error); d != boost::filesystem::directory_iterator(); d.increment(error))
+	{
+		if (error)
+		{
+			break;
+		}
+		if (boost::algorithm::iequals(d->path().extension().wstring(), L".part") && !partialFiles.count(core->wstrtostr(d->path().stem().wstring())))
+		{
+			core->getProgram()->logText(boost::str(boost::format("Discarding unjournaled partial file \"%1%\"") % core->wstrtostr(d->path().filename().wstring())));
+			boost::system::error_code removeError;
+			boost::filesystem::remove(d->path(), removeError);
+		}
+	}
+	if (partialFiles.size() != journalSize)
+	{
+		saveJournal();
+	}
+}
+
+bool Transfer::promoteFile(int id)
+{
+	for (std::deque<boost::shared_ptr<File> >::iterator f = queuedFiles.begin(); f != queuedFiles.end(); ++f)
+	{
+		if ((*f)->id == id)
+		{
+			(*f)->essential = true;
+			if (f != queuedFiles.begin())
+			{
+				boost::shared_ptr<File> file = *f;
+				queuedFiles.erase(f);
+				queuedFiles.push_front(file);
+				core->getProgram()->logText(boost::str(boost::format("Transfer of \"%1%\" prioritized for playback") % (file->url.empty() ? file->name : file->url)));
+			}
+			startQueuedFiles();
+			return true;
+		}
+	}
+	if (localFile && localFile->id == id)
+	{
+		localFile->essential = true;
+		return true;
+	}
+	if (signingFile && signingFile->id == id)
+	{
+		signingFile->essential = true;
+		return true;
+	}
+	for (std::set<boost::shared_ptr<File> >::iterator f = remoteFiles.begin(); f != remoteFiles.end(); ++f)
+	{
+		if ((*f)->id == id)
+		{
+			(*f)->essential = true;
+			return true;
+		}
+	}
+	for (std::set<boost::shared_ptr<File> >::iterator f = checkingFiles.begin(); f != checkingFiles.end(); ++f)
+	{
+		if ((*f)->id == id)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void Transfer::readLocalData(std::size_t bytes, const ThrottleHandler &handler)
+{
+	ThrottleHandler throttleHandler = boost::bind(&Transfer::throttle, this, localFile, bytes, handler);
+	if (localFile && localFile->writeBuffer->flushing && localFile->writeBuffer->dataBytes >= WRITE_BUFFER)
+	{
+		localFile->writeBuffer->handler = throttleHandler;
+		return;
+	}
+	throttleHandler();
+}
+
+std::size_t Transfer::receiveLocalData(const char *data, std::size_t size)
+{
+	bool complete = false, result = true;
+	if (localFile->inflater)
+	{
+		size = localFile->inflater->process(data, size, localFile->output);
+		if (localFile->inflater->failed())
+		{
+			core->getProgram()->logText(boost::str(boost::format("Error decompressing data for local file \"%1%\" during transfer") % localFile->name));
+			sendReply(localFile, Client::Error);
+			closeFile(localFile, boost::bind(&Transfer::discardFile, this, localFile));
+			localFile.reset();
+			startQueuedFiles();
+			return size;
+		}
+		if (!localFile->output.empty())
+		{
+			if (localFile->delta)
+			{
+				std::size_t outputBytes = localFile->output.size();
+				result = applyDelta(localFile, &localFile->output[0], outputBytes);
+			}
+			else
+			{
+				writeFile(localFile, localFile->writeBuffer, &localFile->output[0], localFile->output.size(), ThrottleHandler());
+			}
+			localFile->output.clear();
+		}
+		complete = localFile->inflater->finished();
+	}
+	else if (localFile->delta)
+	{
+		result = applyDelta(localFile, data, size);
+	}
+	else
+	{
+		std::size_t remainingBytes = localFile->size - localFile->writeBuffer->offset - localFile->writeBuffer->dataBytes;
+		if (size > remainingBytes)
+		{
+			size = remainingBytes;
+		}
+		writeFile(localFile, localFile->writeBuffer, data, size, ThrottleHandler());
+		complete = localFile->writeBuffer->offset + localFile->writeBuffer->dataBytes >= localFile->size;
+	}
+	if (!result)
+	{
+		core->getProgram()->logText(boost::str(boost::format("Error applying block delta for local file \"%1%\" during transfer") % localFile->name));
+		sendReply(localFile, Client::Error);
+		closeFile(localFile, boost::bind(&Transfer::discardFile, this, localFile));
+		localFile.reset();
+		startQueuedFiles();
+		return size;
+	}
+	if (localFile->delta)
+	{
+		complete = localFile->writeBuffer->offset + localFile->writeBuffer->dataBytes >= localFile->size;
+	}
+	if (complete)
+	{
+		closeFile(localFile, boost::bind(&Transfer::completeLocalFile, this, localFile, _1));
+		localFile.reset();
+		startQueuedFiles();
+	}
+	return size;
+}
+
+void Transfer::sendReply(const boost::shared_ptr<File> &file, int code)
+{
+	std::string buffer = boost::str(boost::format("%1%\t%2%") % Client::Transfer % code);
+	if (core->getNetwork()->features & Features::Concurrent)
+	{
+		buffer.append(boost::str(boost::format("\t%1%") % file->id));
+	}
+	if ((core->getNetwork()->features & Features::Resume) && code == Client::Local)
+	{
+		buffer.append(boost::str(boost::format("\t%1%") % file->offset));
+	}
+	if (code == Client::Delta)
+	{
+		buffer.append(boost::str(boost::format("\t%1%\t%2%") % file->delta->blockSize % file->delta->signatures));
+	}
+	buffer.append("\n");
+	core->getNetwork()->sendAsync(buffer);
+	if (code != Client::Local && code != Client::Delta)
+	{
+		notifyFile(file);
+	}
+}
+
+void Transfer::stop()
+{
+	for (std::set<boost::shared_ptr<File> >::iterator f = remoteFiles.begin(); f != remoteFiles.end(); ++f)
+	{
+		boost::system::error_code error;
+		(*f)->stream->close(error);
+		for (std::vector<boost::shared_ptr<Segment> >::iterator s = (*f)->segments.begin(); s != (*f)->segments.end(); ++s)
+		{
+			(*s)->stream->close(error);
+		}
+		closeFile(*f, boost::bind(&Transfer::discardFile, this, *f));
+	}
+	remoteFiles.clear();
+	for (std::multimap<std::string, boost::shared_ptr<urdl::read_stream> >::iterator s = idleStreams.begin(); s != idleStreams.end(); ++s)
+	{
+		boost::system::error_code error;
+		s->second->close(error);
+	}
+	idleStreams.clear();
+	boost::system::error_code error;
+	throttleTimer.cancel(error);
+	throttledHandlers.clear();
+	checkingFiles.clear();
+	queuedFiles.clear();
+	if (localFile)
+	{
+		localFile->writeBuffer->handler.clear();
+		closeFile(localFile, boost::bind(&Transfer::discardFile, this, localFile));
+		localFile.reset();
+	}
+	if (signingFile)
+	{
+		closeFile(signingFile, boost::bind(&Transfer::discardFile, this, signingFile));
+		signingFile.reset();
+	}
+}
+
+void Transfer::abandonSegments(const boost::shared_ptr<File> &file, const boost::shared_ptr<Segment> &segment)
+{
+	core->getProgram()->logText(boost::str(boost::format("Remote file \"%1%\" changed during segmented transfer, continuing in a single stream") % file->url));
+	for (std::vector<boost::shared_ptr<Segment> >::iterator s = file->segments.begin(); s != file->segments.end(); ++s)
+	{
+		if (*s == segment)
+		{
+			continue;
+		}
+		(*s)->writeBuffer->closed = true;
+		boost::system::error_code error;
+		(*s)->stream->close(error);
+	}
+	file->segments.clear();
+	file->completedSegments = 0;
+	file->stream = segment->stream;
+	file->headers = file->stream->headers();
+	file->size = file->stream->content_length();
+	finishProgress(file, false);
+	file->progress.reset(new Progress);
+	file->progress->size = file->size;
+	file->writeBuffer.reset(new Buffer);
+	file->writeBuffer->progressive = true;
+	savePartialFile(file);
+	readStream(file);
+}
+
+void Transfer::advanceProgress(const boost::shared_ptr<File> &file, std::size_t bytes)
+{
+	if (!file->progress || !bytes)
+	{
+		return;
+	}
+	std::size_t bufferedBytes = PROGRESSIVE_BUFFER;
+	bool buffered = false;
+	{
+		boost::lock_guard<boost::mutex> lock(file->progress->mutex);
+		if (file->progress->size && file->progress->size < bufferedBytes)
+		{
+			bufferedBytes = file->progress->size;
+		}
+		buffered = file->progress->availableBytes < bufferedBytes && file->progress->availableBytes + bytes >= bufferedBytes;
+		file->progress->availableBytes += bytes;
+		file->progress->condition.notify_all();
+	}
+	if (buffered)
+	{
+		notifyFile(file);
+	}
+}
+
+void Transfer::throttle(const boost::shared_ptr<File> &file, std::size_t bytes, const ThrottleHandler &handler)
+{
+	bool prefetch = !file->essential;
+	std::size_t rate = refillTokens(prefetch);
+	if (!rate)
+	{
+		handler();
+		return;
+	}
+	tokens -= static_cast<boost::int64_t>(bytes);
+	if (tokens >= 0 && throttledHandlers.empty())
+	{
+		handler();
+		return;
+	}
+	throttledPrefetch = throttledHandlers.empty() ? prefetch : throttledPrefetch && prefetch;
+	throttledHandlers.push_back(handler);
+	if (throttledHandlers.size() == 1)
+	{
+		startThrottleTimer(rate);
+	}
+}
+
+void Transfer::allocateFile(boost::shared_ptr<File> file)
+{
+	static SetFileInformationByHandleFunction setFileInformationByHandle = reinterpret_cast<SetFileInformationByHandleFunction>(GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "SetFileInformationByHandle"));
+	if (!setFileInformationByHandle || file->size <= file->offset)
+	{
+		return;
+	}
+	file->reservation = CreateFileW(file->temporaryPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file->reservation == INVALID_HANDLE_VALUE)
+	{
+		return;
+	}
+	AllocationInformation allocationInformation;
+	allocationInformation.allocationSize.QuadPart = file->size;
+	setFileInformationByHandle(file->reservation, FileAllocationInformationClass, &allocationInformation, sizeof(allocationInformation));
+}
+
+void Transfer::cacheFile(const boost::shared_ptr<File> &file)
+{
+	std::wstring cachePath = getCachePath(file);
+	if (cachePath.empty())
+	{
+		return;
+	}
+	boost::system::error_code error;
+	if (boost::filesystem::exists(cachePath, error) || error)
+	{
+		return;
+	}
+	boost::filesystem::create_directories(boost::filesystem::path(cachePath).parent_path(), error);
+	if (error)
+	{
+		return;
+	}
+	if (CreateHardLinkW(cachePath.c_str(), file->path.c_str(), NULL))
+	{
+		core->getProgram()->logText(boost::str(boost::format("Local file \"%1%\" added to shared cache") % file->name));
+	}
+}
+
+bool Transfer::applyDelta(const boost::shared_ptr<File> &file, const char *data, std::size_t &size)
+{
+	const char *begin = data, *end = data + size;
+	while (data != end)
+	{
+		if (!file->delta->literalBytes && file->delta->header.empty() && file->writeBuffer->offset + file->writeBuffer->dataBytes >= file->size)
+		{
+			break;
+		}
+		std::size_t availableBytes = end - data;
+		if (file->delta->literalBytes)
+		{
+			std::size_t literalBytes = std::min(availableBytes, file->delta->literalBytes);
+			writeFile(file, file->writeBuffer, data, literalBytes, ThrottleHandler());
+			file->delta->literalBytes -= literalBytes;
+			data += literalBytes;
+			continue;
+		}
+		if (file->delta->header.empty())
+		{
+			file->delta->header.push_back(*data++);
+			--availableBytes;
+		}
+		std::size_t headerSize = 0;
+		switch (file->delta->header.front())
+		{
+			case Delta::Copy:
+			{
+				headerSize = 9;
+				break;
+			}
+			case Delta::Literal:
+			{
+				headerSize = 5;
+				break;
+			}
+			default:
+			{
+				return false;
+			}
+		}
+		std::size_t headerBytes = std::min(availableBytes, headerSize - file->delta->header.size());
+		file->delta->header.insert(file->delta->header.end(), data, data + headerBytes);
+		data += headerBytes;
+		if (file->delta->header.size() < headerSize)
+		{
+			break;
+		}
+		std::size_t remainingBytes = file->size - file->writeBuffer->offset - file->writeBuffer->dataBytes;
+		std::size_t value = decodeInteger(&file->delta->header[1]);
+		if (file->delta->header.front() == Delta::Copy)
+		{
+			std::size_t blocks = (file->delta->sourceSize + file->delta->blockSize - 1) / file->delta->blockSize;
+			std::size_t count = decodeInteger(&file->delta->header[5]);
+			if (!count || value >= blocks || count > blocks - value)
+			{
+				return false;
+			}
+			std::size_t sourceOffset = value * file->delta->blockSize;
+			if (std::min(count * file->delta->blockSize, file->delta->sourceSize - sourceOffset) > remainingBytes)
+			{
+				return false;
+			}
+			copyBlocks(file, value, count);
+		}
+		else
+		{
+			if (value > remainingBytes)
+			{
+				return false;
+			}
+			file->delta->literalBytes = value;
+		}
+		file->delta->header.clear();
+	}
+	size = data - begin;
+	return true;
+}
+
+void Transfer::calculateArchiveChecksum(boost::shared_ptr<Archive> packArchive, boost::shared_ptr<File> file, Archive::Entry entry, CheckHandler handler)
+{
+	std::string checksum;
+	boost::shared_ptr<const char> data = packArchive->mapEntry(entry);
+	if (data || !entry.length)
+	{
+		Digest entryDigest;
+		for (std::size_t offset = 0; offset < entry.length; offset += CHECKSUM_BUFFER)
+		{
+			entryDigest.process(data.get() + offset, std::min<std::size_t>(CHECKSUM_BUFFER, entry.length - offset));
+		}
+		checksum = boost::str(boost::format("%X") % entryDigest.checksum());
+	}
+	io_service.post(boost::bind(&Transfer::handleArchiveChecksum, this, packArchive, file, checksum, handler));
+}
+
+void Transfer::calculateChecksum(boost::shared_ptr<File> file, Checksum checksum, CheckHandler handler)
+{
+	std::fstream fileHandle(file->path.c_str(), std::ios_base::in | std::ios_base::binary);
+	std::vector<char> fileBuffer(CHECKSUM_BUFFER);
+	Digest fileDigest;
+	while (fileHandle)
+	{
+		fileHandle.read(&fileBuffer[0], CHECKSUM_BUFFER);
+		fileDigest.process(&fileBuffer[0], static_cast<std::size_t>(fileHandle.gcount()));
+	}
+	fileHandle.close();
+	checksum.value = boost::str(boost::format("%X") % fileDigest.checksum());
+	io_service.post(boost::bind(&Transfer::handleChecksum, this, file, checksum, handler));
+}
+
+void Transfer::calculateSignatures(boost::shared_ptr<File> file)
+{
+	std::size_t blockSize = std::max<std::size_t>(DELTA_BLOCK, (file->delta->sourceSize + MAX_DELTA_BLOCKS - 1) / MAX_DELTA_BLOCKS);
+	std::fstream fileHandle(file->path.c_str(), std::ios_base::in | std::ios_base::binary);
+	std::vector<char> fileBuffer(blockSize);
+	std::string signatures;
+	while (fileHandle)
+	{
+		fileHandle.read(&fileBuffer[0], static_cast<std::streamsize>(blockSize));
+		std::size_t readBytes = static_cast<std::size_t>(fileHandle.gcount());
+		if (!readBytes)
+		{
+			break;
+		}
+		Digest blockDigest;
+		blockDigest.process(&fileBuffer[0], readBytes);
+		signatures.append(boost::str(boost::format("%08X%08X") % calculateRollingChecksum(reinterpret_cast<const unsigned char*>(&fileBuffer[0]), readBytes) % blockDigest.checksum()));
+	}
+	fileHandle.close();
+	io_service.post(boost::bind(&Transfer::handleSignatures, this, file, blockSize, signatures));
+}
+
+void Transfer::closeFile(const boost::shared_ptr<File> &file, const WriteHandler &handler)
+{
+	std::vector<boost::shared_ptr<Buffer> > buffers;
+	if (file->writeBuffer)
+	{
+		buffers.push_back(file->writeBuffer);
+	}
+	for (std::vector<boost::shared_ptr<Segment> >::iterator s = file->segments.begin(); s != file->segments.end(); ++s)
+	{
+		buffers.push_back((*s)->writeBuffer);
+	}
+	for (std::vector<boost::shared_ptr<Buffer> >::iterator b = buffers.begin(); b != buffers.end(); ++b)
+	{
+		if (!(*b)->closed)
+		{
+			(*b)->closed = true;
+			if ((*b)->dataBytes)
+			{
+				writeService.post(boost::bind(&Transfer::writeBuffer, this, file, *b, true));
+			}
+		}
+	}
+	writeService.post(boost::bind(&Transfer::closeHandle, this, file, handler));
+}
+
+void Transfer::closeHandle(boost::shared_ptr<File> file, WriteHandler handler)
+{
+	if (file->handle.is_open())
+	{
+		file->handle.close();
+	}
+	if (file->delta)
+	{
+		file->delta->source.close();
+	}
+	if (file->reservation != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(file->reservation);
+		file->reservation = INVALID_HANDLE_VALUE;
+	}
+	if (handler)
+	{
+		io_service.post(boost::bind(handler, !file->handle.fail()));
+	}
+}
+
+void Transfer::commitBuffer(const boost::shared_ptr<File> &file, const boost::shared_ptr<Buffer> &buffer, const ThrottleHandler &handler)
+{
+	if (buffer->dataBytes >= WRITE_BUFFER)
+	{
+		if (buffer->flushing)
+		{
+			buffer->handler = handler;
+			return;
+		}
+		flushBuffer(file, buffer);
+	}
+	if (handler)
+	{
+		handler();
+	}
+}
+
+bool Transfer::commitFile(const boost::shared_ptr<File> &file)
+{
+	if (file->temporaryPath.empty())
+	{
+		return true;
+	}
+	return MoveFileExW(file->temporaryPath.c_str(), file->path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+}
+
+void Transfer::completeLocalFile(boost::shared_ptr<File> file, bool result)
+{
+	if (!result)
+	{
+		core->getProgram()->logText(boost::str(boost::format("Error writing data for local file \"%1%\" during transfer") % file->name));
+		sendReply(file, Client::Error);
+		discardFile(file);
+		return;
+	}
+	if (!commitFile(file))
+	{
+		core->getProgram()->logText(boost::str(boost::format("Error replacing \"%1%\" with its transferred copy") % file->name));
+		sendReply(file, Client::Error);
+		removePartialFile(file);
+		discardFile(file);
+		return;
+	}
+	core->getProgram()->logText(boost::str(boost::format("Transfer of local file \"%1%\" complete") % file->name));
+	removePartialFile(file);
+	if (boost::algorithm::iequals(file->name, "audio.pak"))
+	{
+		loadArchive();
+	}
+	core->getAudio()->files.insert(std::make_pair(file->id, file->name));
+	finishProgress(file, true);
+	core->getCache()->enforceQuota();
+	notifyFile(file);
+	if (file->transferable)
+	{
+		checkFile(file, boost::bind(&Transfer::handleVerifyFile, this, file, _1));
+	}
+}
+
+void Transfer::completeRemoteFile(boost::shared_ptr<File> file, bool result)
+{
+	if (!result)
+	{
+		core->getProgram()->logText(boost::str(boost::format("Error writing data for remote file \"%1%\" during transfer") % file->url));
+		sendReply(file, Client::Error);
+		discardFile(file);
+		return;
+	}
+	if (!commitFile(file))
+	{
+		core->getProgram()->logText(boost::str(boost::format("Error replacing \"%1%\" with its transferred copy") % file->name));
+		sendReply(file, Client::Error);
+		removePartialFile(file);
+		discardFile(file);
+		return;
+	}
+	core->getProgram()->logText(boost::str(boost::format("Transfer of remote file \"%1%\" complete") % file->url));
+	saveValidators(file);
+	removePartialFile(file);
+	if (boost::algorithm::iequals(file->name, "audio.pak"))
+	{
+		loadArchive();
+	}
+	sendReply(file, Client::Remote);
+	core->getAudio()->files.insert(std::make_pair(file->id, file->name));
+	finishProgress(file, true);
+	core->getCache()->enforceQuota();
+}
+
+void Transfer::copyBlocks(const boost::shared_ptr<File> &file, std::size_t index, std::size_t count)
+{
+	std::size_t sourceOffset = index * file->delta->blockSize;
+	std::size_t length = std::min(count * file->delta->blockSize, file->delta->sourceSize - sourceOffset);
+	if (file->writeBuffer->dataBytes)
+	{
+		boost::shared_ptr<std::vector<char> > block(new std::vector<char>(file->writeBuffer->data.begin(), file->writeBuffer->data.begin() + file->writeBuffer->dataBytes));
+		writeService.post(boost::bind(&Transfer::writeBlock, this, file, file->writeBuffer->offset, block));
+		file->writeBuffer->offset += file->writeBuffer->dataBytes;
+		file->writeBuffer->dataBytes = 0;
+	}
+	writeService.post(boost::bind(&Transfer::copySource, this, file, sourceOffset, file->writeBuffer->offset, length));
+	file->writeBuffer->offset += length;
+}
+
+void Transfer::copyCachedFile(boost::shared_ptr<File> file, std::wstring cachePath, CheckHandler handler)
+{
+	boost::system::error_code error;
+	boost::filesystem::copy_file(cachePath, file->temporaryPath, boost::filesystem::copy_option::overwrite_if_exists, error);
+	bool result = !error && commitFile(file);
+	if (!result)
+	{
+		boost::filesystem::remove(file->temporaryPath, error);
+	}
+	io_service.post(boost::bind(&Transfer::handleCopyCachedFile, this, file, result, handler));
+}
+
+void Transfer::copySource(boost::shared_ptr<File> file, std::size_t sourceOffset, std::size_t targetOffset, std::size_t length)
+{
+	if (!file->delta->source.is_open())
+	{
+		file->delta->source.open(file->path.c_str(), std::ios_base::in | std::ios_base::binary);
+		file->delta->block.resize(CHECKSUM_BUFFER);
+	}
+	file->delta->source.seekg(static_cast<std::streamoff>(sourceOffset));
+	file->handle.seekp(static_cast<std::streamoff>(targetOffset));
+	while (length && file->handle)
+	{
+		std::size_t blockBytes = std::min<std::size_t>(length, CHECKSUM_BUFFER);
+		file->delta->source.read(&file->delta->block[0], static_cast<std::streamsize>(blockBytes));
+		if (static_cast<std::size_t>(file->delta->source.gcount()) != blockBytes)
+		{
+			file->handle.setstate(std::ios_base::failbit);
+			break;
+		}
+		file->handle.write(&file->delta->block[0], static_cast<std::streamsize>(blockBytes));
+		length -= blockBytes;
+	}
+}
+
+void Transfer::discardFile(boost::shared_ptr<File> file)
+{
+	finishProgress(file, false);
+	if (file->temporaryPath.empty())
+	{
+		return;
+	}
+	boost::system::error_code error;
+	std::map<std::string, PartialFile>::iterator p = partialFiles.find(file->name);
+	if (p != partialFiles.end())
+	{
+		boost::uintmax_t fileSize = boost::filesystem::file_size(file->temporaryPath, error);
+		if (!error)
+		{
+			p->second.bytes = static_cast<std::size_t>(fileSize);
+			saveJournal();
+			return;
+		}
+	}
+	boost::filesystem::remove(file->temporaryPath, error);
+}
+
+void Transfer::finishCheckFile(const boost::shared_ptr<File> &file, const std::string &checksum, const CheckHandler &handler)
+{
+	if (file->checksum.compare(checksum))
+	{
+		handler(false);
+		return;
+	}
+	core->getProgram()->logText(boost::str(boost::format("Local file \"%1%\" passed CRC check") % file->name));
+	core->getAudio()->files.insert(std::make_pair(file->id, file->name));
+	cacheFile(file);
+	notifyFile(file);
+	handler(true);
+}
+
+void Transfer::finishProgress(const boost::shared_ptr<File> &file, bool complete)
+{
+	if (!file->progress)
+	{
+		return;
+	}
+	boost::lock_guard<boost::mutex> lock(file->progress->mutex);
+	if (file->progress->finished)
+	{
+		return;
+	}
+	if (complete)
+	{
+		file->progress->availableBytes = file->progress->size = std::max(file->progress->size, file->progress->availableBytes);
+	}
+	file->progress->complete = complete;
+	file->progress->finished = true;
+	file->progress->condition.notify_all();
+}
+
+void Transfer::finishRemoteFile(const boost::shared_ptr<File> &file)
+{
+	closeFile(file, boost::bind(&Transfer::discardFile, this, file));
+	releaseRemoteFile(file);
+}
+
+void Transfer::flushBuffer(const boost::shared_ptr<File> &file, const boost::shared_ptr<Buffer> &buffer)
+{
+	buffer->flushing = true;
+	buffer->spare.swap(buffer->data);
+	buffer->spareBytes = buffer->dataBytes;
+	buffer->spareOffset = buffer->offset;
+	buffer->dataBytes = 0;
+	buffer->offset += buffer->spareBytes;
+	writeService.post(boost::bind(&Transfer::writeBuffer, this, file, buffer, false));
+}
+
+std::wstring Transfer::getCachePath(const boost::shared_ptr<File> &file)
+{
+	if (!file->transferable || file->checksum.empty() || !boost::algorithm::all(file->checksum, boost::algorithm::is_xdigit()))
+	{
+		return std::wstring();
+	}
+	std::string server = boost::str(boost::format("%1%-%2%") % core->getProgram()->address % core->getProgram()->port);
+	std::replace_if(server.begin(), server.end(), !(boost::algorithm::is_alnum() || boost::algorithm::is_any_of(".-")), '_');
+	return boost::str(boost::wformat(L"%1%\\cache\\%2%\\%3%-%4%") % core->getProgram()->savePath % core->strtowstr(server) % core->strtowstr(file->checksum) % file->size);
+}
+
+std::string Transfer::getHeader(const std::string &headers, const std::string &name)
+{
+	std::vector<std::string> lines;
+	boost::algorithm::split(lines, headers, boost::algorithm::is_any_of("\r\n"), boost::algorithm::token_compress_on);
+	for (std::vector<std::string>::iterator l = lines.begin(); l != lines.end(); ++l)
+	{
+		std::size_t separator = l->find(':');
+		if (separator != std::string::npos && boost::algorithm::iequals(l->substr(0, separator), name))
+		{
+			return boost::algorithm::trim_copy(l->substr(separator + 1));
+		}
+	}
+	return std::string();
+}
+
+std::string Transfer::getRangeValidator(const boost::shared_ptr<File> &file)
+{
+	std::string entityTag = getHeader(file->headers, "ETag");
+	if (!entityTag.empty() && !boost::algorithm::starts_with(entityTag, "W/"))
+	{
+		return entityTag;
+	}
+	return getHeader(file->headers, "Last-Modified");
+}
+std::string Transfer::getValidators(const boost::shared_ptr<File> &file)
+{
+	std::map<std::string, Checksum>::iterator c = checksums.find(file->name);
+	if (c == checksums.end() || (c->second.entityTag.empty() && c->second.lastModified.empty()))
+	{
+		return std::string();
+	}
+	boost::system::error_code error;
+	std::size_t fileSize = static_cast<std::size_t>(boost::filesystem::file_size(file->path, error));
+	if (error || fileSize != c->second.size || boost::filesystem::last_write_time(file->path, error) != c->second.time || error)
+	{
+		return std::string();
+	}
+	std::string validators;
+	if (!c->second.entityTag.empty())
+	{
+		validators.append(boost::str(boost::format("If-None-Match: %1%\r\n") % c->second.entityTag));
+	}
+	if (!c->second.lastModified.empty())
+	{
+		validators.append(boost::str(boost::format("If-Modified-Since: %1%\r\n") % c->second.lastModified));
+	}
+	return validators;
+}
+
+bool Transfer::isPartialFile(const boost::shared_ptr<File> &file)
+{
+	std::map<std::string, PartialFile>::iterator p = partialFiles.find(file->name);
+	if (p == partialFiles.end())
+	{
+		return false;
+	}
+	if (file->url.empty())
+	{
+		if (!(core->getNetwork()->features & Features::Resume) || p->second.checksum != file->checksum || p->second.size != file->size)
+		{
+			return false;
+		}
+	}
+	else
+	{
+		if (p->second.url != file->url)
+		{
+			return false;
+		}
+	}
+	boost::system::error_code error;
+	boost::uintmax_t fileSize = boost::filesystem::file_size(file->temporaryPath, error);
+	if (error)
+	{
+		return false;
+	}
+	std::size_t offset = std::min(static_cast<std::size_t>(fileSize), p->second.bytes);
+	if (!offset || offset >= p->second.size)
+	{
+		return false;
+	}
+	file->offset = offset;
+	return true;
+}
+
+bool Transfer::isPrefetching()
+{
+	if ((localFile && localFile->essential) || (signingFile && signingFile->essential))
+	{
+		return false;
+	}
+	for (std::set<boost::shared_ptr<File> >::iterator f = remoteFiles.begin(); f != remoteFiles.end(); ++f)
+	{
+		if ((*f)->essential)
+		{
+			return false;
+		}
+	}
+	return queuedFiles.empty() || !queuedFiles.front()->essential;
+}
+
+bool Transfer::linkCachedFile(const boost::shared_ptr<File> &file, const CheckHandler &handler)
+{
+	std::wstring cachePath = getCachePath(file);
+	if (cachePath.empty())
+	{
+		return false;
+	}
+	boost::system::error_code error;
+	std::size_t cacheSize = static_cast<std::size_t>(boost::filesystem::file_size(cachePath, error));
+	if (error || cacheSize != file->size)
+	{
+		return false;
+	}
+	if (CreateHardLinkW(file->path.c_str(), cachePath.c_str(), NULL))
+	{
+		recordCachedFile(file);
+		return false;
+	}
+	startWorkers();
+	checkingFiles.insert(file);
+	workService.post(boost::bind(&Transfer::copyCachedFile, this, file, cachePath, handler));
+	return true;
+}
+
+void Transfer::notifyFile(const boost::shared_ptr<File> &file)
+{
+	io_service.post(boost::bind(&Audio::resumePendingPlays, core->getAudio(), file->id));
+}
+
+boost::asio::mutable_buffers_1 Transfer::prepareBuffer(const boost::shared_ptr<Buffer> &buffer, std::size_t limit)
+{
+	return boost::asio::buffer(&buffer->data[buffer->dataBytes], std::min(buffer->data.size() - buffer->dataBytes, limit));
+}
+
+void Transfer::readSegment(const boost::shared_ptr<File> &file, const boost::shared_ptr<Segment> &segment)
+{
+	segment->stream->async_read_some(prepareBuffer(segment->writeBuffer, segment->remainingBytes), boost::bind(&Transfer::handleReadSegment, this, file, segment, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+}
+
+void Transfer::readStream(const boost::shared_ptr<File> &file)
+{
+	if (!file->inflater)
+	{
+		file->stream->async_read_some(prepareBuffer(file->writeBuffer, file->writeBuffer->data.size()), boost::bind(&Transfer::handleReadStream, this, file, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+		return;
+	}
+	file->stream->async_read_some(boost::asio::buffer(file->buffer.c_array(), file->buffer.size()), boost::bind(&Transfer::handleReadStream, this, file, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+}
+
+bool Transfer::recordCachedFile(const boost::shared_ptr<File> &file)
+{
+	boost::system::error_code error;
+	if (!boost::filesystem::exists(file->path, error))
+	{
+		return false;
+	}
+	if (checksums.erase(file->name) && checkingFiles.empty())
+	{
+		saveChecksums();
+	}
+	core->getProgram()->logText(boost::str(boost::format("Local file \"%1%\" restored from shared cache") % file->name));
+	return true;
+}
+
+std::size_t Transfer::refillTokens(bool prefetch)
+{
+	std::size_t rate = core->getGame()->open ? core->getProgram()->settings->gameTransferRate : core->getProgram()->settings->transferRate;
+	std::size_t prefetchRate = core->getProgram()->settings->prefetchTransferRate;
+	if (prefetch && prefetchRate && (!rate || prefetchRate < rate))
+	{
+		rate = prefetchRate;
+	}
+	boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+	if (!rate || refillTime.is_not_a_date_time())
+	{
+		refillTime = now;
+		tokens = static_cast<boost::int64_t>(rate);
+		return rate;
+	}
+	tokens += static_cast<boost::int64_t>(rate) * (now - refillTime).total_microseconds() / 1000000;
+	if (tokens > static_cast<boost::int64_t>(rate))
+	{
+		tokens = static_cast<boost::int64_t>(rate);
+	}
+	refillTime = now;
+	return rate;
+}
+
+void Transfer::releaseRemoteFile(const boost::shared_ptr<File> &file)
+{
+	for (std::vector<boost::shared_ptr<Segment> >::iterator s = file->segments.begin(); s != file->segments.end(); ++s)
+	{
+		if ((*s)->stream == file->stream)
+		{
+			continue;
+		}
+		if ((*s)->stream->is_reusable() && idleStreams.count(file->host) < core->getProgram()->settings->concurrentTransfers)
+		{
+			idleStreams.insert(std::make_pair(file->host, (*s)->stream));
+		}
+		else
+		{
+			boost::system::error_code error;
+			(*s)->stream->close(error);
+		}
+	}
+	file->segments.clear();
+	if (file->stream->is_reusable() && idleStreams.count(file->host) < core->getProgram()->settings->concurrentTransfers)
+	{
+		idleStreams.insert(std::make_pair(file->host, file->stream));
+	}
+	else
+	{
+		boost::system::error_code error;
+		file->stream->close(error);
+	}
+	remoteFiles.erase(file);
+	startQueuedFiles();
+}
+
+void Transfer::removePartialFile(const boost::shared_ptr<File> &file)
+{
+	if (partialFiles.erase(file->name))
+	{
+		saveJournal();
+	}
+}
+
+void Transfer::runWorker()
+{
+	boost::system::error_code error;
+	workService.run(error);
+}
+
+void Transfer::runWriter()
+{
+	boost::system::error_code error;
+	writeService.run(error);
+}
+
+void Transfer::saveChecksums()
+{
+	std::wstring filePath = boost::str(boost::wformat(L"%1%\\checksums.ini") % core->getProgram()->downloadPath);
+	CSimpleIniW ini(true, false, true);
+	for (std::map<std::string, Checksum>::iterator c = checksums.begin(); c != checksums.end(); ++c)
+	{
+		std::wstring section = core->strtowstr(c->first);
+		ini.SetValue(section.c_str(), L"size", boost::lexical_cast<std::wstring>(c->second.size).c_str());
+		ini.SetValue(section.c_str(), L"time", boost::lexical_cast<std::wstring>(c->second.time).c_str());
+		ini.SetValue(section.c_str(), L"crc", core->strtowstr(c->second.value).c_str());
+		if (!c->second.entityTag.empty())
+		{
+			ini.SetValue(section.c_str(), L"etag", core->strtowstr(c->second.entityTag).c_str());
+		}
+		if (!c->second.lastModified.empty())
+		{
+			ini.SetValue(section.c_str(), L"modified", core->strtowstr(c->second.lastModified).c_str());
+		}
+	}
+	ini.SaveFile(filePath.c_str());
+}
+
+void Transfer::saveJournal()
+{
+	if (journalPath.empty())
+	{
+		return;
+	}
+	if (partialFiles.empty())
+	{
+		boost::system::error_code error;
+		boost::filesystem::remove(journalPath, error);
+		return;
+	}
+	CSimpleIniW ini(true, false, true);
+	for (std::map<std::string, PartialFile>::iterator p = partialFiles.begin(); p != partialFiles.end(); ++p)
+	{
+		std::wstring section = core->strtowstr(p->first);
+		ini.SetValue(section.c_str(), L"bytes", boost::lexical_cast<std::wstring>(p->second.bytes).c_str());
+		ini.SetValue(section.c_str(), L"checksum", core->strtowstr(p->second.checksum).c_str());
+		ini.SetValue(section.c_str(), L"size", boost::lexical_cast<std::wstring>(p->second.size).c_str());
+		ini.SetValue(section.c_str(), L"url", core->strtowstr(p->second.url).c_str());
+	}
+	ini.SaveFile(journalPath.c_str());
+}
+
+void Transfer::saveValidators(const boost::shared_ptr<File> &file)
+{
+	Checksum checksum;
+	checksum.entityTag = getHeader(file->headers, "ETag");
+	checksum.lastModified = getHeader(file->headers, "Last-Modified");
+	if (checksum.entityTag.empty() && checksum.lastModified.empty())
+	{
+		return;
+	}
+	boost::system::error_code error;
+	checksum.size = static_cast<std::size_t>(boost::filesystem::file_size(file->path, error));
+	if (!error)
+	{
+		checksum.time = boost::filesystem::last_write_time(file->path, error);
+	}
+	if (error)
+	{
+		return;
+	}
+	checksums[file->name] = checksum;
+	saveChecksums();
+}
+
+void Transfer::savePartialFile(const boost::shared_ptr<File> &file)
+{
+	PartialFile partialFile;
+	partialFile.bytes = file->offset;
+	partialFile.checksum = file->checksum;
+	partialFile.size = file->size;
+	partialFile.url = file->url;
+	partialFiles[file->name] = partialFile;
+	saveJournal();
+}
+
+void Transfer::startLocalFile()
+{
+	if (localFile->offset)
+	{
+		localFile->handle.open(localFile->temporaryPath.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+	}
+	else
+	{
+		boost::system::error_code error;
+		std::size_t sourceSize = static_cast<std::size_t>(boost::filesystem::file_size(localFile->path, error));
+		if ((core->getNetwork()->features & Features::Delta) && !error && sourceSize)
+		{
+			localFile->delta.reset(new Delta);
+			localFile->delta->sourceSize = sourceSize;
+		}
+		localFile->handle.open(localFile->temporaryPath.c_str(), std::ios_base::out | std::ios_base::binary);
+	}
+	if (!localFile->handle)
+	{
+		core->getProgram()->logText(boost::str(boost::format("Error opening \"%1%\" for writing") % localFile->name));
+		sendReply(localFile, Client::Error);
+		localFile.reset();
+		return;
+	}
+	if (core->getNetwork()->features & Features::Compressed)
+	{
+		localFile->inflater.reset(new Inflater(Inflater::Zlib));
+	}
+	if (localFile->delta)
+	{
+		localFile->handle.rdbuf()->pubsetbuf(NULL, 0);
+		localFile->writeBuffer.reset(new Buffer);
+		signingFile = localFile;
+		localFile.reset();
+		startWorkers();
+		workService.post(boost::bind(&Transfer::calculateSignatures, this, signingFile));
+		return;
+	}
+	localFile->progress.reset(new Progress);
+	localFile->progress->availableBytes = localFile->offset;
+	localFile->handle.rdbuf()->pubsetbuf(NULL, 0);
+	localFile->writeBuffer.reset(new Buffer);
+	localFile->writeBuffer->offset = localFile->offset;
+	localFile->writeBuffer->progressive = true;
+	if (!localFile->inflater)
+	{
+		localFile->progress->size = localFile->size;
+		writeService.post(boost::bind(&Transfer::allocateFile, this, localFile));
+	}
+	savePartialFile(localFile);
+	if (localFile->offset)
+	{
+		core->getProgram()->logText(boost::str(boost::format("Resuming local file \"%1%\" at %2% of %3%...") % localFile->name % core->outputFileSize(localFile->offset) % core->outputFileSize(localFile->size)));
+	}
+	else
+	{
+		core->getProgram()->logText(boost::str(boost::format("Transferring local file \"%1%\" (%2%)...") % localFile->name % core->outputFileSize(localFile->size)));
+	}
+	sendReply(localFile, Client::Local);
+}
+
+void Transfer::startQueuedFiles()
+{
+	bool concurrent = (core->getNetwork()->features & Features::Concurrent) != 0;
+	bool essential = !isPrefetching();
+	std::deque<boost::shared_ptr<File> >::iterator f = queuedFiles.begin();
+	while (f != queuedFiles.end())
+	{
+		if (!concurrent && (localFile || signingFile || !remoteFiles.empty()))
+		{
+			break;
+		}
+		if ((*f)->essential)
+		{
+			essential = true;
+		}
+		else if (essential)
+		{
+			break;
+		}
+		if ((*f)->url.empty())
+		{
+			if (localFile || signingFile)
+			{
+				++f;
+				continue;
+			}
+			localFile = *f;
+			f = queuedFiles.erase(f);
+			startLocalFile();
+		}
+		else
+		{
+			if (remoteFiles.size() >= core->getProgram()->settings->concurrentTransfers)
+			{
+				++f;
+				continue;
+			}
+			boost::shared_ptr<File> file = *f;
+			f = queuedFiles.erase(f);
+			startRemoteFile(file);
+		}
+	}
+	bool active = localFile || signingFile || !remoteFiles.empty();
+	if (active && isPrefetching())
+	{
+		if (!prefetching)
+		{
+			core->getProgram()->logText(boost::str(boost::format("Essential files transferred, prefetching %1% remaining files in the background") % (queuedFiles.size() + remoteFiles.size() + (localFile || signingFile ? 1 : 0))));
+		}
+		prefetching = true;
+	}
+	else if (!active)
+	{
+		prefetching = false;
+	}
+}
+
+void Transfer::startRemoteFile(const boost::shared_ptr<File> &file)
+{
+	file->host = urdl::url(file->url).to_string(urdl::url::host_component | urdl::url::port_component);
+	std::multimap<std::string, boost::shared_ptr<urdl::read_stream> >::iterator s = idleStreams.find(file->host);
+	if (s != idleStreams.end())
+	{
+		file->reused = true;
+		file->stream = s->second;
+		idleStreams.erase(s);
+	}
+	else
+	{
+		file->reused = false;
+		file->stream.reset(new urdl::read_stream(io_service));
+		file->stream->set_option(urdl::http::keep_alive(true));
+	}
+	if (isPartialFile(file))
+	{
+		file->stream->set_option(urdl::http::request_headers(boost::str(boost::format("Range: bytes=%1%-\r\n") % file->offset)));
+	}
+	else
+	{
+		boost::system::error_code error;
+		std::string headers = getValidators(file);
+		if (!headers.empty() || !boost::filesystem::exists(file->path, error))
+		{
+			headers.append("Accept-Encoding: gzip, deflate\r\n");
+		}
+		file->stream->set_option(urdl::http::request_headers(headers));
+	}
+	remoteFiles.insert(file);
+	file->stream->async_open(file->url, boost::bind(&Transfer::handleOpenStream, this, file, boost::asio::placeholders::error));
+}
+
+void Transfer::startSegments(const boost::shared_ptr<File> &file)
+{
+	removePartialFile(file);
+	std::size_t segmentCount = core->getProgram()->settings->transferSegments;
+	std::size_t segmentSize = (file->size + segmentCount - 1) / segmentCount;
+	std::string validator = getRangeValidator(file);
+	core->getProgram()->logText(boost::str(boost::format("Transferring remote file \"%1%\" (%2%) in %3% segments...") % file->url % core->outputFileSize(file->size) % segmentCount));
+	file->completedSegments = 0;
+	for (std::size_t offset = 0; offset < file->size; offset += segmentSize)
+	{
+		boost::shared_ptr<Segment> segment(new Segment);
+		segment->offset = offset;
+		segment->remainingBytes = std::min(segmentSize, file->size - offset);
+		segment->writeBuffer.reset(new Buffer);
+		segment->writeBuffer->offset = offset;
+		segment->writeBuffer->progressive = !offset;
+		file->segments.push_back(segment);
+	}
+	for (std::vector<boost::shared_ptr<Segment> >::iterator s = file->segments.begin(); s != file->segments.end(); ++s)
+	{
+		if (s == file->segments.begin())
+		{
+			(*s)->stream = file->stream;
+			readSegment(file, *s);
+			continue;
+		}
+		(*s)->stream.reset(new urdl::read_stream(io_service));
+		(*s)->stream->set_option(urdl::http::keep_alive(true));
+		(*s)->stream->set_option(urdl::http::request_headers(boost::str(boost::format("Range: bytes=%1%-%2%\r\nIf-Range: %3%\r\n") % (*s)->offset % ((*s)->offset + (*s)->remainingBytes - 1) % validator)));
+		(*s)->stream->async_open(file->url, boost::bind(&Transfer::handleOpenSegment, this, file, *s, boost::asio::placeholders::error));
+	}
+}
+
+void Transfer::startThrottleTimer(std::size_t rate)
+{
+	boost::int64_t delay = -tokens * 1000 / static_cast<boost::int64_t>(rate);
+	if (delay < 10)
+	{
+		delay = 10;
+	}
+	throttleTimer.expires_from_now(boost::posix_time::milliseconds(delay));
+	throttleTimer.async_wait(boost::bind(&Transfer::handleThrottleTimer, this, boost::asio::placeholders::error));
+}
+
+void Transfer::startWorkers()
+{
+	if (!work)
+	{
+		work.reset(new boost::asio::io_service::work(workService));
+		for (unsigned int i = 0; i < core->getProgram()->settings->verificationThreads; ++i)
+		{
+			workers.create_thread(boost::bind(&Transfer::runWorker, this));
+		}
+	}
+}
+
+void Transfer::updatePartialFile(const boost::shared_ptr<File> &file, std::size_t bytes)
+{
+	std::map<std::string, PartialFile>::iterator p = partialFiles.find(file->name);
+	if (p == partialFiles.end())
+	{
+		return;
+	}
+	p->second.bytes = bytes;
+	boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+	if (!journalTime.is_not_a_date_time() && now - journalTime < boost::posix_time::milliseconds(JOURNAL_INTERVAL))
+	{
+		return;
+	}
+	journalTime = now;
+	saveJournal();
+}
+
+void Transfer::writeBlock(boost::shared_ptr<File> file, std::size_t offset, boost::shared_ptr<std::vector<char> > block)
+{
+	file->handle.seekp(static_cast<std::streamoff>(offset));
+	file->handle.write(&block->at(0), static_cast<std::streamsize>(block->size()));
+}
+
+void Transfer::writeBuffer(boost::shared_ptr<File> file, boost::shared_ptr<Buffer> buffer, bool remaining)
+{
+	std::vector<char> &block = remaining ? buffer->data : buffer->spare;
+	std::size_t blockBytes = remaining ? buffer->dataBytes : buffer->spareBytes;
+	file->handle.seekp(static_cast<std::streamoff>(remaining ? buffer->offset : buffer->spareOffset));
+	file->handle.write(&block[0], static_cast<std::streamsize>(blockBytes));
+	if (buffer->progressive)
+	{
+		file->handle.flush();
+		advanceProgress(file, blockBytes);
+	}
+	if (!remaining)
+	{
+		io_service.post(boost::bind(&Transfer::handleWriteBuffer, this, file, buffer, !file->handle.fail()));
+	}
+}
+
+void Transfer::writeFile(const boost::shared_ptr<File> &file, const boost::shared_ptr<Buffer> &buffer, const char *data, std::size_t size, const ThrottleHandler &handler)
+{
+	if (size)
+	{
+		if (buffer->dataBytes + size > buffer->data.size())
+		{
+			buffer->data.resize(buffer->dataBytes + size);
+		}
+		std::copy(data, data + size, &buffer->data[buffer->dataBytes]);
+		buffer->dataBytes += size;
+	}
+	commitBuffer(file, buffer, handler);
+}
@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2012 Incognito
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include "archive.h"
+#include "inflater.h"
+#include "plugin.h"
+
+#include <boost/array.hpp>
+#include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <urdl/read_stream.hpp>
+
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+class Transfer
+{
+public:
+	Transfer(boost::asio::io_service &io_service);
+	~Transfer();
+
+	typedef boost::function<void (bool)> CheckHandler;
+	typedef boost::function<void ()> ThrottleHandler;
+	typedef boost::function<void (bool)> WriteHandler;
+
+	struct Buffer
+	{
+		Buffer();
+
+		bool closed;
+		std::vector<char> data;
+		std::size_t dataBytes;
+		bool flushing;
+		ThrottleHandler handler;
+		std::size_t offset;
+		bool progressive;
+		std::vector<char> spare;
+		std::size_t spareBytes;
+		std::size_t spareOffset;
+	};
+
+	struct Delta
+	{
+		Delta();
+
+		enum Instructions
+		{
+			Copy = 1,
+			Literal = 2
+		};
+
+		std::vector<char> block;
+		std::size_t blockSize;
+		std::vector<char> header;
+		std::size_t literalBytes;
+		std::string signatures;
+		std::fstream source;
+		std::size_t sourceSize;
+	};
+
+	struct Progress
+	{
+		Progress();
+
+		std::size_t availableBytes;
+		bool complete;
+		boost::condition_variable condition;
+		bool finished;
+		boost::mutex mutex;
+		std::size_t size;
+	};
+
+	struct Segment
+	{
+		Segment();
+
+		std::size_t offset;
+		std::size_t remainingBytes;
+		boost::shared_ptr<urdl::read_stream> stream;
+		boost::shared_ptr<Buffer> writeBuffer;
+	};
+
+	struct File
+	{
+		File();
+
+		boost::array<char, MAX_BUFFER> buffer;
+		std::string checksum;
+		std::size_t completedSegments;
+		boost::shared_ptr<Delta> delta;
+		bool essential;
+		std::fstream handle;
+		std::string headers;
+		std::string host;
+		int id;
+		boost::shared_ptr<Inflater> inflater;
+		std::string name;
+		std::size_t offset;
+		std::vector<char> output;
+		std::wstring path;
+		boost::shared_ptr<Progress> progress;
+		HANDLE reservation;
+		bool reused;
+		std::vector<boost::shared_ptr<Segment> > segments;
+		std::size_t size;
+		boost::shared_ptr<urdl::read_stream> stream;
+		std::wstring temporaryPath;
+		bool transferable;
+		std::string url;
+		boost::shared_ptr<Buffer> writeBuffer;
+	};
+
+	boost::shared_ptr<Archive> archive;
+	boost::shared_ptr<File> localFile;
+
+	void addFile(const boost::shared_ptr<File> &file);
+	void cancelLocalFile();
+	void checkFile(const boost::shared_ptr<File> &file, const CheckHandler &handler);
+	boost::shared_ptr<File> findFile(int id);
+	void loadArchive();
+	void loadChecksums();
+	void loadJournal();
+	bool promoteFile(int id);
+	void readLocalData(std::size_t bytes, const ThrottleHandler &handler);
+	std::size_t receiveLocalData(const char *data, std::size_t size);
+	void sendReply(const boost::shared_ptr<File> &file, int code);
+	void stop();
+	void throttle(const boost::shared_ptr<File> &file, std::size_t bytes, const ThrottleHandler &handler);
+private:
+	struct Checksum
+	{
+		Checksum();
+
+		std::string entityTag;
+		std::string lastModified;
+		std::size_t size;
+		std::time_t time;
+		std::string value;
+	};
+
+	void handleArchiveChecksum(boost::shared_ptr<Archive> packArchive, boost::shared_ptr<File> file, std::string checksum, CheckHandler handler);
+	void handleChecksum(boost::shared_ptr<File> file, Checksum checksum, CheckHandler handler);
+	void handleCheckFile(boost::shared_ptr<File> file, bool result);
+	void handleCopyCachedFile(boost::shared_ptr<File> file, bool result, CheckHandler handler);
+	void handleOpenSegment(boost::shared_ptr<File> file, boost::shared_ptr<Segment> segment, const boost::system::error_code &error);
+	void handleOpenStream(boost::shared_ptr<File> file, const boost::system::error_code &error);
+	void handleReadSegment(boost::shared_ptr<File> file, boost::shared_ptr<Segment> segment, const boost::system::error_code &error, std::size_t transferredBytes);
+	void handleReadStream(boost::shared_ptr<File> file, const boost::system::error_code &error, std::size_t transferredBytes);
+	void handleSignatures(boost::shared_ptr<File> file, std::size_t blockSize, std::string signatures);
+	void handleThrottleTimer(const boost::system::error_code &error);
+	void handleVerifyFile(boost::shared_ptr<File> file, bool result);
+	void handleWriteBuffer(boost::shared_ptr<File> file, boost::shared_ptr<Buffer> buffer, bool result);
+
+	void abandonSegments(const boost::shared_ptr<File> &file, const boost::shared_ptr<Segment> &segment);
+	void advanceProgress(const boost::shared_ptr<File> &file, std::size_t bytes);
+	void allocateFile(boost::shared_ptr<File> file);
+	bool applyDelta(const boost::shared_ptr<File> &file, const char *data, std::size_t &size);
+	void cacheFile(const boost::shared_ptr<File> &file);
+	void calculateArchiveChecksum(boost::shared_ptr<Archive> packArchive, boost::shared_ptr<File> file, Archive::Entry entry, CheckHandler handler);
+	void calculateChecksum(boost::shared_ptr<File> file, Checksum checksum, CheckHandler handler);
+	void calculateSignatures(boost::shared_ptr<File> file);
+	void closeFile(const boost::shared_ptr<File> &file, const WriteHandler &handler);
+	void closeHandle(boost::shared_ptr<File> file, WriteHandler handler);
+	void commitBuffer(const boost::shared_ptr<File> &file, const boost::shared_ptr<Buffer> &buffer, const ThrottleHandler &handler);
+	bool commitFile(const boost::shared_ptr<File> &file);
+	void completeLocalFile(boost::shared_ptr<File> file, bool result);
+	void completeRemoteFile(boost::shared_ptr<File> file, bool result);
+	void copyBlocks(const boost::shared_ptr<File> &file, std::size_t index, std::size_t count);
+	void copyCachedFile(boost::shared_ptr<File> file, std::wstring cachePath, CheckHandler handler);
+	void copySource(boost::shared_ptr<File> file, std::size_t sourceOffset, std::size_t targetOffset, std::size_t length);
+	void discardFile(boost::shared_ptr<File> file);
+	void finishCheckFile(const boost::shared_ptr<File> &file, const std::string &checksum, const CheckHandler &handler);
+	void finishProgress(const boost::shared_ptr<File> &file, bool complete);
+	void finishRemoteFile(const boost::shared_ptr<File> &file);
+	void flushBuffer(const boost::shared_ptr<File> &file, const boost::shared_ptr<Buffer> &buffer);
+	std::wstring getCachePath(const boost::shared_ptr<File> &file);
+	std::string getHeader(const std::string &headers, const std::string &name);
+	std::string getRangeValidator(const boost::shared_ptr<File> &file);
+	std::string getValidators(const boost::shared_ptr<File> &file);
+	bool isPartialFile(const boost::shared_ptr<File> &file);
+	bool isPrefetching();
+	bool linkCachedFile(const boost::shared_ptr<File> &file, const CheckHandler &handler);
+	boost::asio::mutable_buffers_1 prepareBuffer(const boost::shared_ptr<Buffer> &buffer, std::size_t limit);
+	void notifyFile(const boost::shared_ptr<File> &file);
+	void queueFile(const boost::shared_ptr<File> &file);
+	void readSegment(const boost::shared_ptr<File> &file, const boost::shared_ptr<Segment> &segment);
+	void readStream(const boost::shared_ptr<File> &file);
+	bool recordCachedFile(const boost::shared_ptr<File> &file);
+	std::size_t refillTokens(bool prefetch);
+	void releaseRemoteFile(const boost::shared_ptr<File> &file);
+	void removePartialFile(const boost::shared_ptr<File> &file);
+	void runWorker();
+	void runWriter();
+	void saveChecksums();
+	void saveJournal();
+	void savePartialFile(const boost::shared_ptr<File> &file);
+	void saveValidators(const boost::shared_ptr<File> &file);
+	void startLocalFile();
+	void startQueuedFiles();
+	void startRemoteFile(const boost::shared_ptr<File> &file);
+	void startSegments(const boost::shared_ptr<File> &file);
+	void startThrottleTimer(std::size_t rate);
+	void startWorkers();
+	void updatePartialFile(const boost::shared_ptr<File> &file, std::size_t bytes);
+	void writeBlock(boost::shared_ptr<File> file, std::size_t offset, boost::shared_ptr<std::vector<char> > block);
+	void writeBuffer(boost::shared_ptr<File> file, boost::shared_ptr<Buffer> buffer, bool remaining);
+	void writeFile(const boost::shared_ptr<File> &file, const boost::shared_ptr<Buffer> &buffer, const char *data, std::size_t size, const ThrottleHandler &handler);
+
+	struct PartialFile
+	{
+		PartialFile();
+
+		std::size_t bytes;
+		std::string checksum;
+		std::size_t size;
+		std::string url;
+	};
+
+	std::set<boost::shared_ptr<File> > checkingFiles;
+	std::map<std::string, Checksum> checksums;
+	std::multimap<std::string, boost::shared_ptr<urdl::read_stream> > idleStreams;
+	std::wstring journalPath;
+	boost::posix_time::ptime journalTime;
+	std::map<std::string, PartialFile> partialFiles;
+	bool prefetching;
+	std::deque<boost::shared_ptr<File> > queuedFiles;
+	std::set<boost::shared_ptr<File> > remoteFiles;
+	boost::posix_time::ptime refillTime;
+	boost::shared_ptr<File> signingFile;
+	std::deque<ThrottleHandler> throttledHandlers;
+	bool throttledPrefetch;
+	boost::int64_t tokens;
+
+	boost::asio::io_service &io_service;
+	boost::asio::deadline_timer throttleTimer;
+	boost::scoped_ptr<boost::asio::io_service::work> work;
+	boost::thread_group workers;
+	boost::asio::io_service workService;
+	boost::scoped_ptr<boost::asio::io_service::work> writeWork;
+	boost::thread writer;
+	boost::asio::io_service writeService;
+};
+
+#endif